@@ -0,0 +1,6 @@
+# Remove the generator stamp when the generated source is missing, so that the build
+#  runs carp.py again instead of failing to find the file.
+# Usage: cmake -DCARP_OUTPUT=<generated source> -DCARP_STAMP=<stamp> -P carp_check_output.cmake
+if (NOT EXISTS ${CARP_OUTPUT})
+    file(REMOVE ${CARP_STAMP})
+endif()
@@ -1,10 +1,12 @@
 #include "carp.h"
 #include "carp_backend.h"
 #include "carp_argument_vector.h"
+#include "carp_async.h"
+#include "carp_libc.h"
+#include "carp_record.h"
+#include "carp_trace.h"
 
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
+#include <stdint.h>
 
 #ifdef CARP_UNIT_TEST
 #define CARP_STATIC
@@ -12,6 +14,16 @@
 #define CARP_STATIC static
 #endif
 
+#define CARP_VECTOR_INIT_CAP 25
+#define CARP_COMPLETE_FLAG "--carp-complete"
+
+// Arguments collected for an option with "repeat": "aggregate".
+// The callback is invoked once, after parsing, with the arguments of every occurrence.
+struct CarpAggregate {
+    const struct CarpOptionSpec* spec;
+    struct CarpArgumentVector args;
+};
+
 struct CarpPrivate {
     const char** argv;
 
@@ -25,6 +37,19 @@ struct CarpPrivate {
         const int tail;
         const char* token;
     } state;
+
+    struct CarpAsync* async;
+
+    // Indexed by CarpOptionSpec.slot; allocated on the first aggregated occurrence
+    struct CarpAggregate* aggregates;
+
+    // Bitset of the option ids seen on the command line, indexed by CarpOptionSpec.id.
+    // Only allocated if the json file declares constraints between options.
+    uint64_t* seen;
+    const char* constraint_other;
+
+    // Collects the parse result for carp_parse_save(), otherwise NULL
+    struct CarpRecord* record;
 };
 
 enum CarpTokenType {
@@ -38,6 +63,10 @@ enum CarpError {
     ERROR_NOT_ENOUGH_ARGUMENTS = 0,
     ERROR_UNKNOWN_OPTION,
     ERROR_LONG_OPTION_ARGUMENT_COUNT,
+    ERROR_OUT_OF_MEMORY,
+    ERROR_MISSING_REQUIRED_OPTION,
+    ERROR_CONFLICTING_OPTIONS,
+    ERROR_MISSING_DEPENDENCY,
     ERROR_COUNT
 };
 
@@ -47,7 +76,7 @@ CARP_STATIC void carp_error_msg_not_enough_arguments(
     char* msg_buf,
     int buf_size)
 {
-    (void)snprintf(msg_buf, buf_size, "Token '%s': not enough arguments supplied to option", c->state.token);
+    (void)carp_snprintf(msg_buf, buf_size, "Token '%s': not enough arguments supplied to option", c->state.token);
 }
 
 CARP_STATIC void carp_error_msg_unknown_option(
@@ -55,7 +84,7 @@ CARP_STATIC void carp_error_msg_unknown_option(
     char* msg_buf,
     int buf_size)
 {
-    (void)snprintf(msg_buf, buf_size, "Token '%s': unknown option", c->state.token);
+    (void)carp_snprintf(msg_buf, buf_size, "Token '%s': unknown option", c->state.token);
 }
 
 CARP_STATIC void carp_error_msg_long_option_argument_count(
@@ -65,7 +94,84 @@ CARP_STATIC void carp_error_msg_long_option_argument_count(
 {
     // Throw this error when a long option is provided with an immediate argument (e.g.: --long=argument)
     //  but the option spec requires multiple arguments.
-    (void)snprintf(msg_buf, buf_size, "Token '%s': option requires multiple arguments but use of '=' implies single argument", c->state.token);
+    (void)carp_snprintf(msg_buf, buf_size, "Token '%s': option requires multiple arguments but use of '=' implies single argument", c->state.token);
+}
+
+CARP_STATIC void carp_error_msg_out_of_memory(
+    struct CarpPrivate* c,
+    char* msg_buf,
+    int buf_size)
+{
+    // Allocations also fail outside of any token (before parsing, or while delivering
+    //  aggregated options), so the message doesn't mention one
+    (void)c;
+    (void)carp_snprintf(msg_buf, buf_size, "out of memory");
+}
+
+CARP_STATIC void carp_error_msg_missing_required_option(
+    struct CarpPrivate* c,
+    char* msg_buf,
+    int buf_size)
+{
+    (void)carp_snprintf(msg_buf, buf_size, "Option '%s': option is required", c->state.token);
+}
+
+CARP_STATIC void carp_error_msg_conflicting_options(
+    struct CarpPrivate* c,
+    char* msg_buf,
+    int buf_size)
+{
+    (void)carp_snprintf(msg_buf, buf_size, "Option '%s': cannot be combined with option '%s'", c->state.token, c->constraint_other);
+}
+
+CARP_STATIC void carp_error_msg_missing_dependency(
+    struct CarpPrivate* c,
+    char* msg_buf,
+    int buf_size)
+{
+    (void)carp_snprintf(msg_buf, buf_size, "Option '%s': requires option '%s'", c->state.token, c->constraint_other);
+}
+
+#ifdef CARP_FREESTANDING
+static CARP_ERROR_HOOK carp_error_hook = NULL;
+
+void carp_set_error_hook(
+    CARP_ERROR_HOOK hook)
+{
+    carp_error_hook = hook;
+}
+#endif
+
+// Report 'msg' and end the program
+CARP_STATIC void carp_fail(
+    const char* msg)
+{
+#ifdef CARP_FREESTANDING
+    if (carp_error_hook) {
+        carp_error_hook(msg);
+    }
+    __builtin_trap();
+#else
+    printf("[carp] %s\n", msg);
+    exit(EXIT_FAILURE);
+#endif
+}
+
+CARP_STATIC void carp_aggregate_cleanup(
+    struct CarpPrivate* c)
+{
+    if (c->aggregates == NULL) {
+        return;
+    }
+
+    int count = carp_backend_aggregate_count();
+    for (int slot = 0; slot < count; slot++) {
+        if (c->aggregates[slot].spec != NULL) {
+            carp_vector_cleanup(&c->aggregates[slot].args);
+        }
+    }
+    carp_free(c->aggregates);
+    c->aggregates = NULL;
 }
 
 CARP_STATIC void carp_exit_with_error(
@@ -75,29 +181,37 @@ CARP_STATIC void carp_exit_with_error(
     static const CARP_ERROR_MSG_GENERATOR error_generator[ERROR_COUNT] = {
         [ERROR_NOT_ENOUGH_ARGUMENTS] = carp_error_msg_not_enough_arguments,
         [ERROR_UNKNOWN_OPTION] = carp_error_msg_unknown_option,
-        [ERROR_LONG_OPTION_ARGUMENT_COUNT] = carp_error_msg_long_option_argument_count
+        [ERROR_LONG_OPTION_ARGUMENT_COUNT] = carp_error_msg_long_option_argument_count,
+        [ERROR_OUT_OF_MEMORY] = carp_error_msg_out_of_memory,
+        [ERROR_MISSING_REQUIRED_OPTION] = carp_error_msg_missing_required_option,
+        [ERROR_CONFLICTING_OPTIONS] = carp_error_msg_conflicting_options,
+        [ERROR_MISSING_DEPENDENCY] = carp_error_msg_missing_dependency
     };
     static char msg_buf[100] = {0};
 
     error_generator[error](c, msg_buf, sizeof(msg_buf));
+    CARP_TRACE2(error, error, msg_buf);
 
+    // Wait for async callbacks so that none are still running when the error is reported
+    carp_async_abort(c->async);
     carp_vector_cleanup(c->callback_args);
     carp_vector_cleanup(c->command_args);
+    carp_aggregate_cleanup(c);
+    carp_free(c->seen);
 
-    printf("[carp] %s\n", msg_buf);
-    exit(EXIT_FAILURE);
+    carp_fail(msg_buf);
 }
 
 CARP_STATIC enum CarpTokenType carp_classify_token(
     const char* token)
 {
-    if (!strncmp(token, "--", 2) && strlen(token) == 2) {
+    if (!carp_strncmp(token, "--", 2) && carp_strlen(token) == 2) {
         return TOKEN_SEPARATOR;
     }
-    else if (!strncmp(token, "--", 2)) {
+    else if (!carp_strncmp(token, "--", 2)) {
         return TOKEN_LONG_OPTION;
     }
-    else if (!strncmp(token, "-", 1)) {
+    else if (!carp_strncmp(token, "-", 1)) {
         return TOKEN_SHORT_OPTION;
     }
     else {
@@ -105,20 +219,138 @@ CARP_STATIC enum CarpTokenType carp_classify_token(
     }
 }
 
-CARP_STATIC void carp_callback_wrapper(
-    CARP_CALLBACK cb,
-    void* cb_param,
+CARP_STATIC void carp_push_argument(
+    struct CarpPrivate* c,
+    struct CarpArgumentVector* vec,
+    const char* arg)
+{
+    if (carp_vector_push(vec, arg)) {
+        carp_exit_with_error(c, ERROR_OUT_OF_MEMORY);
+    }
+}
+
+CARP_STATIC void carp_callback_dispatch(
+    struct CarpPrivate* c,
+    const struct CarpOptionSpec* spec,
     const char** argv,
     int argc)
 {
-    if (cb) {
-        cb(cb_param, argv, argc);
+    CARP_CALLBACK cb = carp_backend_callback(spec);
+
+    if (cb && (spec->flags & CARP_SPEC_ASYNC)) {
+        if (carp_async_submit(c->async, cb, c->callback_param, spec->id, argv, argc, spec->level)) {
+            carp_exit_with_error(c, ERROR_OUT_OF_MEMORY);
+        }
+    }
+    else if (cb) {
+        CARP_TRACE2(callback__enter, spec->id, argc);
+        cb(c->callback_param, argv, argc);
+        CARP_TRACE1(callback__exit, spec->id);
     }
     else {
         // TODO: error?
     }
 }
 
+CARP_STATIC void carp_aggregate_collect(
+    struct CarpPrivate* c,
+    const struct CarpOptionSpec* spec,
+    const char** argv,
+    int argc)
+{
+    if (c->aggregates == NULL) {
+        c->aggregates = carp_calloc(carp_backend_aggregate_count(), sizeof(struct CarpAggregate));
+        if (c->aggregates == NULL) {
+            carp_exit_with_error(c, ERROR_OUT_OF_MEMORY);
+        }
+    }
+
+    struct CarpAggregate* aggregate = &c->aggregates[spec->slot];
+    if (aggregate->spec == NULL) {
+        if (carp_vector_init(&aggregate->args, CARP_VECTOR_INIT_CAP)) {
+            carp_exit_with_error(c, ERROR_OUT_OF_MEMORY);
+        }
+        aggregate->spec = spec;
+    }
+
+    if (spec->arguments == 0) {
+        // Options without arguments are delivered as an occurrence count
+        carp_push_argument(c, &aggregate->args, NULL);
+    }
+    else {
+        for (int i = 0; i < argc; i++) {
+            carp_push_argument(c, &aggregate->args, argv[i]);
+        }
+    }
+}
+
+CARP_STATIC void carp_aggregate_deliver(
+    struct CarpPrivate* c)
+{
+    if (c->aggregates == NULL) {
+        return;
+    }
+
+    // Deliver in slot order (the order options appear in the json file)
+    int count = carp_backend_aggregate_count();
+    for (int slot = 0; slot < count; slot++) {
+        struct CarpAggregate* aggregate = &c->aggregates[slot];
+        if (aggregate->spec != NULL) {
+            const char** argv = aggregate->spec->arguments == 0 || aggregate->args.size == 0 ? NULL : aggregate->args.buf;
+            carp_callback_dispatch(c, aggregate->spec, argv, aggregate->args.size);
+        }
+    }
+}
+
+CARP_STATIC void carp_check_constraints(
+    struct CarpPrivate* c)
+{
+    unsigned int other = 0;
+    const struct CarpConstraint* violated = NULL;
+
+    if (c->seen == NULL || (violated = carp_backend_check_constraints(c->seen, &other)) == NULL) {
+        return;
+    }
+
+    c->constraint_other = carp_backend_option_name(other);
+    switch (violated->type) {
+        case CARP_CONSTRAINT_REQUIRED:
+            c->state.token = c->constraint_other;
+            carp_exit_with_error(c, ERROR_MISSING_REQUIRED_OPTION);
+            break;
+        case CARP_CONSTRAINT_CONFLICTS:
+            c->state.token = carp_backend_option_name(violated->option);
+            carp_exit_with_error(c, ERROR_CONFLICTING_OPTIONS);
+            break;
+        case CARP_CONSTRAINT_REQUIRES:
+            c->state.token = carp_backend_option_name(violated->option);
+            carp_exit_with_error(c, ERROR_MISSING_DEPENDENCY);
+            break;
+    }
+}
+
+CARP_STATIC void carp_callback_wrapper(
+    struct CarpPrivate* c,
+    const struct CarpOptionSpec* spec,
+    const char** argv,
+    int argc)
+{
+    if (c->seen) {
+        c->seen[spec->id / 64] |= UINT64_C(1) << (spec->id % 64);
+    }
+
+    if (c->record) {
+        carp_record_option(c->record, spec->id, argv, argc);
+    }
+
+    if (spec->flags & CARP_SPEC_AGGREGATE) {
+        carp_aggregate_collect(c, spec, argv, argc);
+    }
+    else {
+        carp_callback_dispatch(c, spec, argv, argc);
+    }
+}
+
 CARP_STATIC int carp_option_argument_handler(
     struct CarpPrivate* c,
     int required_arguments,
@@ -131,15 +363,15 @@ CARP_STATIC int carp_option_argument_handler(
     const char** argument_list = c->argv + head;
 
     if (immediate != NULL && *immediate != '\0') {
-        carp_vector_push(c->callback_args, immediate);
+        carp_push_argument(c, c->callback_args, immediate);
         args_remaining--;
     }
 
     if (required_arguments == -1) {
-        while (carp_classify_token(*argument_list) == TOKEN_ARGUMENT &&
-               head < c->state.tail)
+        while (head < c->state.tail &&
+               carp_classify_token(*argument_list) == TOKEN_ARGUMENT)
         {
-            carp_vector_push(c->callback_args, *argument_list);
+            carp_push_argument(c, c->callback_args, *argument_list);
             argument_list++;
             head_increment++;
             head++;
@@ -147,10 +379,10 @@ CARP_STATIC int carp_option_argument_handler(
     }
     else {
         while (args_remaining > 0) {
-            if (carp_classify_token(*argument_list) == TOKEN_ARGUMENT &&
-                head < c->state.tail)
+            if (head < c->state.tail &&
+                carp_classify_token(*argument_list) == TOKEN_ARGUMENT)
             {
-                carp_vector_push(c->callback_args, *argument_list);
+                carp_push_argument(c, c->callback_args, *argument_list);
                 argument_list++;
                 args_remaining--;
                 head_increment++;
@@ -168,21 +400,21 @@ CARP_STATIC int carp_option_argument_handler(
 CARP_STATIC void carp_parse_short_option(
     struct CarpPrivate* c)
 {
-    struct CarpOptionSpec* spec = NULL;
+    const struct CarpOptionSpec* spec = NULL;
     int head_increment = 1;
 
     // +1 to skip '-'
     const char* token = c->state.token + 1;
-    int tokenlen = strlen(token);
+    int tokenlen = carp_strlen(token);
 
     for (const char* opt = token; opt < (token + tokenlen); opt++) {
         if ((spec = carp_backend_search(opt, 1)) != NULL) {
             if (spec->arguments == 0) {
-                carp_callback_wrapper(spec->callback, c->callback_param, NULL, 0);
+                carp_callback_wrapper(c, spec, NULL, 0);
             }
             else {
                 head_increment = carp_option_argument_handler(c, spec->arguments, opt + 1);
-                carp_callback_wrapper(spec->callback, c->callback_param, c->callback_args->buf, c->callback_args->size);
+                carp_callback_wrapper(c, spec, c->callback_args->buf, c->callback_args->size);
                 c->callback_args->size = 0;
                 goto next_token;
             }
@@ -199,16 +431,16 @@ next_token:
 CARP_STATIC void carp_parse_long_option(
     struct CarpPrivate* c)
 {
-    struct CarpOptionSpec* spec = NULL;
+    const struct CarpOptionSpec* spec = NULL;
     int head_increment = 1;
 
     // +2 to skip '--'
     const char* opt = c->state.token + 2;
-    int optlen = strlen(opt);
-    char* search = strchr(opt, '=');
+    int optlen = carp_strlen(opt);
+    char* search = carp_strchr(opt, '=');
 
     if (search) {
-        long long diff = llabs(search - opt);
+        int diff = search - opt;
 
         // Error if empty immediate argument (e.g.: '--long=')
         if (diff == (optlen - 1)) {
@@ -221,7 +453,7 @@ CARP_STATIC void carp_parse_long_option(
             }
             else {
                 head_increment = carp_option_argument_handler(c, spec->arguments, search + 1);
-                carp_callback_wrapper(spec->callback, c->callback_param, c->callback_args->buf, c->callback_args->size);
+                carp_callback_wrapper(c, spec, c->callback_args->buf, c->callback_args->size);
                 c->callback_args->size = 0;
             }
         }
@@ -233,11 +465,11 @@ CARP_STATIC void carp_parse_long_option(
         if ((spec = carp_backend_search(opt, optlen)) != NULL) {
             if (spec->arguments == -1 || spec->arguments > 0) {
                 head_increment = carp_option_argument_handler(c, spec->arguments, NULL);
-                carp_callback_wrapper(spec->callback, c->callback_param, c->callback_args->buf, c->callback_args->size);
+                carp_callback_wrapper(c, spec, c->callback_args->buf, c->callback_args->size);
                 c->callback_args->size = 0;
             }
             else {
-                carp_callback_wrapper(spec->callback, c->callback_param, NULL, 0);
+                carp_callback_wrapper(c, spec, NULL, 0);
             }
         }
         else {
@@ -253,25 +485,122 @@ CARP_STATIC void carp_parse_arguments_after_separator(
 {
     while (c->state.head < c->state.tail) {
         c->state.token = c->argv[c->state.head++];
-        carp_vector_push(c->command_args, c->state.token);
+        carp_push_argument(c, c->command_args, c->state.token);
     }
 }
 
-void carp_parse(
+#ifndef CARP_FREESTANDING
+// Print the option flags which start with 'prefix', one per line, and exit.
+// Invoked by the generated shell completion scripts as '<program> --carp-complete <prefix>'.
+CARP_STATIC void carp_complete(
+    const char* prefix)
+{
+    int first = 0;
+    int count = carp_backend_complete(prefix, carp_strlen(prefix), &first);
+
+    for (int i = first; i < first + count; i++) {
+        printf("%s\n", carp_backend_completion(i));
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+#if defined(CARP_EARLY_COMPLETION) && defined(__GLIBC__)
+// glibc passes argc and argv to the functions in .preinit_array, which run before any
+//  constructor or main(), so completion requests are answered before program startup code runs.
+// Only usable when carp is linked into an executable.
+static void carp_complete_early(
+    int argc,
+    char* argv[])
+{
+    if (argc >= 2 && !carp_strcmp(argv[1], CARP_COMPLETE_FLAG)) {
+        carp_complete(argc >= 3 ? argv[2] : "");
+    }
+}
+
+__attribute__((section(".preinit_array"), used))
+static void (*const carp_complete_early_init)(int, char*[]) = carp_complete_early;
+#endif
+#endif
+
+// Parse the command line held in 'c', invoking the callback of each option found
+CARP_STATIC void carp_parse_tokens(
+    struct CarpPrivate* c)
+{
+    while (c->state.head < c->state.tail) {
+        c->state.token = c->argv[c->state.head];
+        enum CarpTokenType type = carp_classify_token(c->state.token);
+        CARP_TRACE2(token, c->state.token, type);
+        switch (type) {
+            case TOKEN_SHORT_OPTION:
+                carp_parse_short_option(c);
+                break;
+            case TOKEN_LONG_OPTION:
+                carp_parse_long_option(c);
+                break;
+            case TOKEN_SEPARATOR:
+                c->state.head++;
+                carp_parse_arguments_after_separator(c);
+                break;
+            case TOKEN_ARGUMENT:
+                carp_push_argument(c, c->command_args, c->state.token);
+                c->state.head++;
+                break;
+        }
+    }
+}
+
+// Invoke the options of a record as if they had just been parsed, without looking at the command line
+CARP_STATIC void carp_replay(
+    struct CarpPrivate* c,
+    const struct CarpRecordView* view)
+{
+    const struct CarpRecordHeader* header = view->header;
+
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        const struct CarpRecordEntry* entry = &view->entries[i];
+        const struct CarpOptionSpec* spec = carp_backend_spec(entry->id);
+
+        c->callback_args->size = 0;
+        for (uint32_t a = 0; a < entry->argc; a++) {
+            carp_push_argument(c, c->callback_args, view->blob + view->arguments[entry->first + a]);
+        }
+        c->state.token = carp_backend_option_name(entry->id);
+        carp_callback_wrapper(c, spec, spec->arguments == 0 ? NULL : c->callback_args->buf, entry->argc);
+    }
+    c->callback_args->size = 0;
+
+    for (uint32_t i = header->argument_count - header->positional_count; i < header->argument_count; i++) {
+        carp_push_argument(c, c->command_args, view->blob + view->arguments[i]);
+    }
+}
+
+// Parse 'argv', or replay 'view' if it isn't NULL, then deliver the results.
+// If 'record' isn't NULL, the result is also collected into it.
+CARP_STATIC void carp_run(
     struct Carp* carp,
     int argc,
     char* argv[],
-    void* callback_param)
+    void* callback_param,
+    struct CarpRecord* record,
+    const struct CarpRecordView* view)
 {
+#ifndef CARP_FREESTANDING
+    // There is no stdout to answer completion requests on in a freestanding build
+    if (view == NULL && argc >= 2 && !carp_strcmp(argv[1], CARP_COMPLETE_FLAG)) {
+        carp_complete(argc >= 3 ? argv[2] : "");
+    }
+#endif
+
     struct CarpArgumentVector callback_args;
     struct CarpArgumentVector command_args;
+    struct CarpAsync async;
 
-#define CARP_VECTOR_INIT_CAP 25
     if (carp_vector_init(&callback_args, CARP_VECTOR_INIT_CAP) ||
         carp_vector_init(&command_args, CARP_VECTOR_INIT_CAP))
     {
-        // TODO: error msg
-        exit(1);
+        CARP_TRACE2(error, ERROR_OUT_OF_MEMORY, "out of memory");
+        carp_fail("out of memory");
     }
 
     struct CarpPrivate c = {
@@ -283,42 +612,106 @@ void carp_parse(
             .head = 1,
             .tail = argc,
             .token = NULL
-        }
+        },
+        .async = &async,
+        .aggregates = NULL,
+        .seen = NULL,
+        .constraint_other = NULL,
+        .record = record
     };
 
-    while (c.state.head < c.state.tail) {
-        c.state.token = argv[c.state.head];
-        switch (carp_classify_token(c.state.token)) {
-            case TOKEN_SHORT_OPTION:
-                carp_parse_short_option(&c);
-                break;
-            case TOKEN_LONG_OPTION:
-                carp_parse_long_option(&c);
-                break;
-            case TOKEN_SEPARATOR:
-                c.state.head++;
-                carp_parse_arguments_after_separator(&c);
-                break;
-            case TOKEN_ARGUMENT:
-                carp_vector_push(c.command_args, c.state.token);
-                c.state.head++;
-                break;
+    carp_async_init(c.async);
+    CARP_TRACE2(parse__start, argc, argv);
+
+    if (carp_backend_constraint_count() > 0) {
+        c.seen = carp_calloc((carp_backend_option_count() + 63) / 64, sizeof(uint64_t));
+        if (c.seen == NULL) {
+            carp_exit_with_error(&c, ERROR_OUT_OF_MEMORY);
         }
     }
 
+    if (view) {
+        carp_replay(&c, view);
+    }
+    else {
+        carp_parse_tokens(&c);
+    }
+
+    carp_check_constraints(&c);
+    carp_free(c.seen);
+    c.seen = NULL;
+
+    if (c.record) {
+        carp_record_positional(c.record, c.command_args->buf, c.command_args->size);
+    }
+
+    carp_aggregate_deliver(&c);
+    carp_aggregate_cleanup(&c);
+
+    // Run the deferred async callbacks and wait for all of them to return
+    carp_async_finish(c.async);
+
     // No longer needed; all option callbacks should have been called by now
     carp_vector_cleanup(c.callback_args);
+    CARP_TRACE1(parse__end, c.command_args->size);
 
     if (carp) {
         carp->argv = c.command_args->buf;
         carp->argc = c.command_args->size;
     }
+    else {
+        carp_vector_cleanup(c.command_args);
+    }
+}
+
+void carp_parse(
+    struct Carp* carp,
+    int argc,
+    char* argv[],
+    void* callback_param)
+{
+    carp_run(carp, argc, argv, callback_param, NULL, NULL);
+}
+
+#ifndef CARP_FREESTANDING
+int carp_parse_save(
+    struct Carp* carp,
+    int argc,
+    char* argv[],
+    void* callback_param,
+    int fd)
+{
+    struct CarpRecord record;
+    carp_record_init(&record);
+
+    carp_run(carp, argc, argv, callback_param, &record, NULL);
+
+    int error = carp_record_write(&record, fd);
+    carp_record_cleanup(&record);
+
+    return error;
+}
+
+int carp_load_parsed(
+    struct Carp* carp,
+    int fd,
+    void* callback_param)
+{
+    struct CarpRecordView view;
+
+    if (carp_record_map(fd, &view)) {
+        return 1;
+    }
+
+    carp_run(carp, 0, NULL, callback_param, NULL, &view);
+    return 0;
 }
+#endif
 
 void carp_cleanup(
     struct Carp *carp)
 {
-    free(carp->argv);
+    carp_free(carp->argv);
     carp->argv = NULL;
     carp->argc = 0;
 }
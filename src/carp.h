@@ -13,3 +13,41 @@ void carp_parse(
 
 void carp_cleanup(
     struct Carp* carp);
+
+#ifndef CARP_FREESTANDING
+// Same as carp_parse(), and also write a record of the result to 'fd' (e.g.: a memfd),
+//  replacing its contents. The record holds the options found, their arguments, and the
+//  non-option arguments, so other processes can replay it with carp_load_parsed().
+// Returns non-zero if the record couldn't be written; parsing itself is unaffected.
+int carp_parse_save(
+    struct Carp* carp,
+    int argc,
+    char* argv[],
+    void* callback_param,
+    int fd);
+
+// Map the record in 'fd' and invoke the option callbacks it holds, in the same order and with
+//  the same arguments as carp_parse() did, without parsing a command line. 'carp' receives
+//  the non-option arguments, which point into the mapping (it is never unmapped).
+// Returns non-zero, without invoking anything, if 'fd' doesn't hold a record written by a
+//  program built from the same option table.
+int carp_load_parsed(
+    struct Carp* carp,
+    int fd,
+    void* callback_param);
+#endif
+
+#ifdef CARP_FREESTANDING
+// Receives the error message when parsing fails.
+// carp cannot resume parsing afterwards, so the hook must not return (e.g.: exit the process).
+typedef void (*CARP_ERROR_HOOK)(const char* msg);
+
+void carp_set_error_hook(
+    CARP_ERROR_HOOK hook);
+
+// All memory used by carp, including the non-option argument buffer, is taken from 'storage'.
+// Must be called before carp_parse().
+void carp_set_storage(
+    void* storage,
+    unsigned long size);
+#endif
@@ -1,12 +1,12 @@
 #include "carp_argument_vector.h"
 
-#include <stdlib.h>
+#include "carp_libc.h"
 
 static int resize(
     struct CarpArgumentVector* vec,
     int capacity)
 {
-    void* mem = realloc(vec->buf, capacity * sizeof(char*));
+    void* mem = carp_realloc(vec->buf, capacity * sizeof(char*));
 
     if (mem) {
         vec->buf = (const char**)mem;
@@ -22,7 +22,7 @@ int carp_vector_init(
     struct CarpArgumentVector* vec,
     int capacity)
 {
-    void* mem = malloc(capacity * (sizeof(char*)));
+    void* mem = carp_malloc(capacity * (sizeof(char*)));
 
     if (mem) {
         vec->buf = (const char**)mem;
@@ -38,21 +38,22 @@ int carp_vector_init(
 void carp_vector_cleanup(
     struct CarpArgumentVector* vec)
 {
-    free(vec->buf);
+    carp_free(vec->buf);
     vec->buf = NULL;
     vec->capacity = 0;
     vec->size = 0;
 }
 
-void carp_vector_push(
+int carp_vector_push(
     struct CarpArgumentVector* vec,
     const char* elem)
 {
-    if (vec->size == vec->capacity) {
-        resize(vec, vec->capacity * 2);
+    if (vec->size == vec->capacity && resize(vec, vec->capacity * 2)) {
+        return 1;
     }
 
     vec->buf[vec->size++] = elem;
+    return 0;
 }
 
 const char* carp_vector_pop(
@@ -13,7 +13,7 @@ int carp_vector_init(
 void carp_vector_cleanup(
     struct CarpArgumentVector* vec);
 
-void carp_vector_push(
+int carp_vector_push(
     struct CarpArgumentVector* vec,
     const char* elem);
 
@@ -0,0 +1,252 @@
+#include "carp_async.h"
+
+#include "carp_libc.h"
+#include "carp_trace.h"
+
+static struct CarpAsyncJob* job_create(
+    CARP_CALLBACK callback,
+    void* callback_param,
+    unsigned int id,
+    const char** argv,
+    int argc,
+    int level)
+{
+    struct CarpAsyncJob* job = carp_malloc(sizeof(*job) + argc * sizeof(char*));
+
+    if (job) {
+        job->next = NULL;
+        job->callback = callback;
+        job->callback_param = callback_param;
+        job->id = id;
+        job->level = level;
+        job->argc = argc;
+        if (argc > 0) {
+            (void)memcpy(job->argv, argv, argc * sizeof(char*));
+        }
+    }
+
+    return job;
+}
+
+static void job_run(
+    struct CarpAsyncJob* job)
+{
+    CARP_TRACE2(callback__enter, job->id, job->argc);
+    job->callback(job->callback_param, job->argc > 0 ? job->argv : NULL, job->argc);
+    CARP_TRACE1(callback__exit, job->id);
+}
+
+#ifdef CARP_ENABLE_ASYNC
+static void* worker(
+    void* arg)
+{
+    struct CarpAsync* async = arg;
+
+    pthread_mutex_lock(&async->lock);
+    for (;;) {
+        while (async->queue == NULL && !async->shutdown) {
+            pthread_cond_wait(&async->work, &async->lock);
+        }
+        if (async->queue == NULL) {
+            break;
+        }
+
+        struct CarpAsyncJob* job = async->queue;
+        async->queue = job->next;
+        if (async->queue == NULL) {
+            async->queue_tail = &async->queue;
+        }
+        pthread_mutex_unlock(&async->lock);
+
+        job_run(job);
+        carp_free(job);
+
+        pthread_mutex_lock(&async->lock);
+        if (--async->pending == 0) {
+            pthread_cond_broadcast(&async->idle);
+        }
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    return NULL;
+}
+
+static void start_threads(
+    struct CarpAsync* async)
+{
+    if (async->started) {
+        return;
+    }
+    async->started = 1;
+
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->work, NULL);
+    pthread_cond_init(&async->idle, NULL);
+
+    for (int i = 0; i < CARP_ASYNC_THREADS; i++) {
+        if (pthread_create(&async->threads[i], NULL, worker, async)) {
+            break;
+        }
+        async->thread_count++;
+    }
+}
+
+static void wait_idle(
+    struct CarpAsync* async)
+{
+    pthread_mutex_lock(&async->lock);
+    while (async->pending > 0) {
+        pthread_cond_wait(&async->idle, &async->lock);
+    }
+    pthread_mutex_unlock(&async->lock);
+}
+
+static void stop_threads(
+    struct CarpAsync* async)
+{
+    if (!async->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&async->lock);
+    async->shutdown = 1;
+    pthread_cond_broadcast(&async->work);
+    pthread_mutex_unlock(&async->lock);
+
+    for (int i = 0; i < async->thread_count; i++) {
+        pthread_join(async->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&async->idle);
+    pthread_cond_destroy(&async->work);
+    pthread_mutex_destroy(&async->lock);
+}
+#endif
+
+// Run 'job' now, or hand it to the thread pool if there is one
+static void dispatch(
+    struct CarpAsync* async,
+    struct CarpAsyncJob* job)
+{
+#ifdef CARP_ENABLE_ASYNC
+    start_threads(async);
+
+    if (async->thread_count > 0) {
+        pthread_mutex_lock(&async->lock);
+        *async->queue_tail = job;
+        async->queue_tail = &job->next;
+        async->pending++;
+        pthread_cond_signal(&async->work);
+        pthread_mutex_unlock(&async->lock);
+        return;
+    }
+#else
+    (void)async;
+#endif
+
+    job_run(job);
+    carp_free(job);
+}
+
+void carp_async_init(
+    struct CarpAsync* async)
+{
+    async->deferred = NULL;
+    async->deferred_tail = &async->deferred;
+    async->max_level = 0;
+
+#ifdef CARP_ENABLE_ASYNC
+    async->started = 0;
+    async->thread_count = 0;
+    async->queue = NULL;
+    async->queue_tail = &async->queue;
+    async->pending = 0;
+    async->shutdown = 0;
+#endif
+}
+
+int carp_async_submit(
+    struct CarpAsync* async,
+    CARP_CALLBACK callback,
+    void* callback_param,
+    unsigned int id,
+    const char** argv,
+    int argc,
+    int level)
+{
+    struct CarpAsyncJob* job = job_create(callback, callback_param, id, argv, argc, level);
+
+    if (job == NULL) {
+        return 1;
+    }
+
+    if (level == 0) {
+        dispatch(async, job);
+    }
+    else {
+        *async->deferred_tail = job;
+        async->deferred_tail = &job->next;
+        if (level > async->max_level) {
+            async->max_level = level;
+        }
+    }
+
+    return 0;
+}
+
+void carp_async_finish(
+    struct CarpAsync* async)
+{
+    for (int level = 1; level <= async->max_level; level++) {
+#ifdef CARP_ENABLE_ASYNC
+        // Every job at a lower level must have returned before this level starts
+        if (async->started) {
+            wait_idle(async);
+        }
+#endif
+        struct CarpAsyncJob** link = &async->deferred;
+        while (*link) {
+            struct CarpAsyncJob* job = *link;
+            if (job->level == level) {
+                *link = job->next;
+                job->next = NULL;
+                dispatch(async, job);
+            }
+            else {
+                link = &job->next;
+            }
+        }
+    }
+
+#ifdef CARP_ENABLE_ASYNC
+    if (async->started) {
+        wait_idle(async);
+    }
+    stop_threads(async);
+#endif
+
+    carp_async_init(async);
+}
+
+void carp_async_abort(
+    struct CarpAsync* async)
+{
+    // Jobs that were started during parsing are allowed to return (in a sequential build they
+    //  would already have run), while deferred jobs are dropped. Which callbacks ran is then
+    //  independent of thread timing, and nothing is left executing when the error is reported.
+    while (async->deferred) {
+        struct CarpAsyncJob* job = async->deferred;
+        async->deferred = job->next;
+        carp_free(job);
+    }
+    async->max_level = 0;
+
+#ifdef CARP_ENABLE_ASYNC
+    if (async->started) {
+        wait_idle(async);
+    }
+    stop_threads(async);
+#endif
+
+    carp_async_init(async);
+}
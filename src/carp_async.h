@@ -0,0 +1,67 @@
+#pragma once
+
+#include "carp_backend.h"
+
+#ifdef CARP_ENABLE_ASYNC
+#include <pthread.h>
+#endif
+
+#ifndef CARP_ASYNC_THREADS
+#define CARP_ASYNC_THREADS 4
+#endif
+
+// A callback invocation whose execution has been handed off to the async executor.
+// The argument buffer is copied into the job, since the parser reuses its own buffer.
+struct CarpAsyncJob {
+    struct CarpAsyncJob* next;
+    CARP_CALLBACK callback;
+    void* callback_param;
+    unsigned int id;
+    int level;
+    int argc;
+    const char* argv[];
+};
+
+// Runs callbacks of options marked "async" in the json file.
+// Jobs with level 0 have no dependencies and are started as soon as they're submitted.
+// Jobs with a higher level are held until carp_async_finish(), which runs them one level
+//  at a time, so a job only starts after every job at a lower level has returned.
+// Without CARP_ENABLE_ASYNC, level 0 jobs run inline and the rest run sequentially
+//  from carp_async_finish(), in the same order the threaded executor would respect.
+struct CarpAsync {
+    struct CarpAsyncJob* deferred;
+    struct CarpAsyncJob** deferred_tail;
+    int max_level;
+
+#ifdef CARP_ENABLE_ASYNC
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    pthread_t threads[CARP_ASYNC_THREADS];
+    int thread_count;
+    int started;
+
+    struct CarpAsyncJob* queue;
+    struct CarpAsyncJob** queue_tail;
+    int pending;
+    int shutdown;
+#endif
+};
+
+void carp_async_init(
+    struct CarpAsync* async);
+
+int carp_async_submit(
+    struct CarpAsync* async,
+    CARP_CALLBACK callback,
+    void* callback_param,
+    unsigned int id,
+    const char** argv,
+    int argc,
+    int level);
+
+void carp_async_finish(
+    struct CarpAsync* async);
+
+void carp_async_abort(
+    struct CarpAsync* async);
@@ -1,23 +1,191 @@
 #include "carp_backend.h"
 
-#include <stdlib.h>
+#include "carp_libc.h"
+#include "carp_trace.h"
 
 #ifdef CARP_IMPLEMENTATION_HASH
-extern struct CarpOptionSpec* carp_hash(const char* name, int len);
+extern const struct CarpOptionSpec* carp_hash(const char* name, int len);
 #else
-extern struct CarpOptionSpec* carp_search(const char* name, int len);
+extern const struct CarpOptionSpec* carp_search(const char* name, int len);
 #endif
 
-struct CarpOptionSpec* carp_backend_search(
+extern const CARP_CALLBACK carp_callbacks[];
+extern const int carp_aggregate_count;
+extern const int carp_option_count;
+extern const int carp_constraint_count;
+extern const struct CarpConstraint carp_constraints[];
+extern const uint64_t carp_constraint_masks[];
+extern const char* carp_option_name(unsigned int id);
+extern const struct CarpOptionSpec* carp_option_spec(unsigned int id);
+extern const uint64_t carp_table_id;
+extern const int carp_completion_count;
+extern const char* carp_completion(int i);
+
+#ifdef CARP_PROFILE
+// Append the name of every option found to the file named by $CARP_PROFILE_FILE
+//  (or "carp.profile"), one per line. carp.py reads it back with '--profile'.
+static void profile_record(
+    const char* name,
+    int len)
+{
+    static FILE* profile = NULL;
+    static int failed = 0;
+
+    if (profile == NULL && !failed) {
+        const char* path = getenv("CARP_PROFILE_FILE");
+        profile = fopen(path ? path : "carp.profile", "a");
+        failed = profile == NULL;
+    }
+
+    if (profile) {
+        (void)fwrite(name, 1, len, profile);
+        (void)fputc('\n', profile);
+    }
+}
+#endif
+
+const struct CarpOptionSpec* carp_backend_search(
     const char* name,
     int len)
 {
-    struct CarpOptionSpec* spec = NULL;
+    const struct CarpOptionSpec* spec = NULL;
 #ifdef CARP_IMPLEMENTATION_HASH
     spec = carp_hash(name, len);
 #else
     spec = carp_search(name, len);
 #endif
 
+    CARP_TRACE3(search, name, len, spec != NULL);
+
+#ifdef CARP_PROFILE
+    if (spec) {
+        profile_record(name, len);
+    }
+#endif
+
     return spec;
 }
+
+CARP_CALLBACK carp_backend_callback(
+    const struct CarpOptionSpec* spec)
+{
+    return carp_callbacks[spec->callback];
+}
+
+int carp_backend_aggregate_count(void)
+{
+    return carp_aggregate_count;
+}
+
+int carp_backend_option_count(void)
+{
+    return carp_option_count;
+}
+
+int carp_backend_constraint_count(void)
+{
+    return carp_constraint_count;
+}
+
+const char* carp_backend_option_name(
+    unsigned int id)
+{
+    return carp_option_name(id);
+}
+
+const struct CarpOptionSpec* carp_backend_spec(
+    unsigned int id)
+{
+    return carp_option_spec(id);
+}
+
+uint64_t carp_backend_table_id(void)
+{
+    return carp_table_id;
+}
+
+static unsigned int first_bit(
+    uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    unsigned int bit = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+const struct CarpConstraint* carp_backend_check_constraints(
+    const uint64_t* seen,
+    unsigned int* other)
+{
+    for (int i = 0; i < carp_constraint_count; i++) {
+        const struct CarpConstraint* constraint = &carp_constraints[i];
+        const uint64_t* mask = carp_constraint_masks + constraint->mask;
+        const uint64_t* words = seen + constraint->word;
+
+        if (constraint->type != CARP_CONSTRAINT_REQUIRED &&
+            !(seen[constraint->option / 64] & (UINT64_C(1) << (constraint->option % 64))))
+        {
+            continue;
+        }
+
+        for (unsigned int w = 0; w < constraint->words; w++) {
+            // Bits of the mask which break the constraint
+            uint64_t violation = constraint->type == CARP_CONSTRAINT_CONFLICTS ?
+                (words[w] & mask[w]) :
+                (~words[w] & mask[w]);
+
+            if (violation) {
+                *other = (constraint->word + w) * 64 + first_bit(violation);
+                return constraint;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Index of the first completion for which 'compare(completion, prefix) >= bias' holds
+static int completion_bound(
+    const char* prefix,
+    int len,
+    int bias)
+{
+    int lo = 0;
+    int hi = carp_completion_count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (carp_strncmp(carp_completion(mid), prefix, len) < bias) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+int carp_backend_complete(
+    const char* prefix,
+    int len,
+    int* first)
+{
+    // Completions are sorted, so the ones starting with 'prefix' form a contiguous range:
+    //  from the first one not less than the prefix, to the first one greater than it
+    //  (comparing only the first 'len' bytes).
+    *first = completion_bound(prefix, len, 0);
+    return completion_bound(prefix, len, 1) - *first;
+}
+
+const char* carp_backend_completion(
+    int i)
+{
+    return carp_completion(i);
+}
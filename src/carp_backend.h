@@ -1,15 +1,89 @@
 #pragma once
 
+#include <stdint.h>
+
 typedef void (*CARP_CALLBACK)(void*, const char**, int);
 
-struct CarpOption {
-    const char* name;
-    struct CarpOptionSpec {
-        int arguments;
-        CARP_CALLBACK callback;
-    } spec;
+enum CarpSpecFlags {
+    // Run the callback on the async executor instead of from within the parser
+    CARP_SPEC_ASYNC = 1 << 0,
+    // Collect the arguments of every occurrence and invoke the callback once, after parsing
+    CARP_SPEC_AGGREGATE = 1 << 1
+};
+
+// Generated option tables contain no pointers, so they need no load-time relocations.
+// The callback is an index into the generated table of callbacks; use
+//  carp_backend_callback() to resolve it.
+// For async options, 'level' orders the callback after the ones it declares in "after":
+//  level 0 callbacks have no dependencies, and every dependency has a lower level.
+// For aggregated options, 'slot' indexes the option's collected arguments; slots are
+//  numbered from 0 to carp_backend_aggregate_count() - 1.
+// 'id' is the index of the option in the json file (shared by its short and long name),
+//  and is the option's bit in the bitset of seen options.
+struct CarpOptionSpec {
+    signed char arguments;
+    unsigned char flags;
+    unsigned char level;
+    unsigned short callback;
+    unsigned short slot;
+    unsigned int id;
+};
+
+enum CarpConstraintType {
+    // Every option in the mask must be seen
+    CARP_CONSTRAINT_REQUIRED = 0,
+    // If 'option' is seen, none of the options in the mask may be seen
+    CARP_CONSTRAINT_CONFLICTS,
+    // If 'option' is seen, every option in the mask must be seen
+    CARP_CONSTRAINT_REQUIRES
 };
 
-struct CarpOptionSpec* carp_backend_search(
+// A relation between options, checked against the bitset of seen options after parsing.
+// The mask covers words [word, word + words) of the bitset and is stored at offset 'mask'
+//  of the generated array of constraint masks.
+struct CarpConstraint {
+    unsigned char type;
+    unsigned int option;
+    unsigned int word;
+    unsigned int words;
+    unsigned int mask;
+};
+
+const struct CarpOptionSpec* carp_backend_search(
     const char* name,
     int len);
+
+CARP_CALLBACK carp_backend_callback(
+    const struct CarpOptionSpec* spec);
+
+int carp_backend_aggregate_count(void);
+
+int carp_backend_option_count(void);
+
+int carp_backend_constraint_count(void);
+
+const char* carp_backend_option_name(
+    unsigned int id);
+
+// The spec of the option with id 'id'
+const struct CarpOptionSpec* carp_backend_spec(
+    unsigned int id);
+
+// Identifies the generated option table; differs between builds with different tables
+uint64_t carp_backend_table_id(void);
+
+// Find the option flags (e.g.: '-f', '--file') which start with 'prefix'.
+// The matches are carp_backend_completion(first) to carp_backend_completion(first + count - 1).
+int carp_backend_complete(
+    const char* prefix,
+    int len,
+    int* first);
+
+const char* carp_backend_completion(
+    int i);
+
+// Returns the first constraint violated by 'seen', or NULL if there is none.
+// 'other' receives the id of the option in the constraint's mask that caused the violation.
+const struct CarpConstraint* carp_backend_check_constraints(
+    const uint64_t* seen,
+    unsigned int* other);
@@ -0,0 +1,198 @@
+#include "carp.h"
+#include "carp_libc.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#ifdef CARP_FREESTANDING
+size_t carp_strlen(
+    const char* s)
+{
+    const char* end = s;
+    while (*end) {
+        end++;
+    }
+
+    return end - s;
+}
+
+int carp_strcmp(
+    const char* a,
+    const char* b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+int carp_strncmp(
+    const char* a,
+    const char* b,
+    size_t n)
+{
+    for (; n > 0; n--, a++, b++) {
+        if (*a != *b || *a == '\0') {
+            return (unsigned char)*a - (unsigned char)*b;
+        }
+    }
+
+    return 0;
+}
+
+char* carp_strchr(
+    const char* s,
+    int c)
+{
+    for (;; s++) {
+        if (*s == (char)c) {
+            return (char*)s;
+        }
+        if (*s == '\0') {
+            return NULL;
+        }
+    }
+}
+
+// Only '%s' and '%%' are supported, which is all carp's messages use
+int carp_snprintf(
+    char* buf,
+    size_t size,
+    const char* fmt,
+    ...)
+{
+    va_list args;
+    size_t len = 0;
+
+    va_start(args, fmt);
+    for (const char* f = fmt; *f; f++) {
+        const char* s = f;
+        size_t n = 1;
+
+        if (f[0] == '%' && f[1] == 's') {
+            s = va_arg(args, const char*);
+            if (s == NULL) {
+                s = "(null)";
+            }
+            n = carp_strlen(s);
+            f++;
+        }
+        else if (f[0] == '%' && f[1] == '%') {
+            f++;
+        }
+
+        for (size_t i = 0; i < n; i++, len++) {
+            if (len + 1 < size) {
+                buf[len] = s[i];
+            }
+        }
+    }
+    va_end(args);
+
+    if (size > 0) {
+        buf[len < size ? len : size - 1] = '\0';
+    }
+
+    return (int)len;
+}
+
+// Memory is handed out from the caller's storage, front to back. Each block is preceded by
+//  its size, so the most recent block can be grown or released in place; that is the common
+//  case, since the argument vectors grow one at a time. Other blocks are only released
+//  when the storage is replaced.
+#define CARP_ALIGN(n) (((n) + _Alignof(max_align_t) - 1) & ~(size_t)(_Alignof(max_align_t) - 1))
+#define CARP_BLOCK_HEADER CARP_ALIGN(sizeof(size_t))
+
+static unsigned char* storage = NULL;
+static size_t storage_size = 0;
+static size_t storage_used = 0;
+static unsigned char* storage_last = NULL;
+
+void carp_set_storage(
+    void* buf,
+    unsigned long size)
+{
+    uintptr_t base = (uintptr_t)buf;
+    uintptr_t aligned = CARP_ALIGN(base);
+
+    storage = (unsigned char*)aligned;
+    storage_size = aligned - base < size ? size - (aligned - base) : 0;
+    storage_used = 0;
+    storage_last = NULL;
+}
+
+static size_t block_size(
+    unsigned char* ptr)
+{
+    return *(size_t*)(ptr - CARP_BLOCK_HEADER);
+}
+
+void* carp_malloc(
+    size_t size)
+{
+    if (size > storage_size || CARP_BLOCK_HEADER + CARP_ALIGN(size) > storage_size - storage_used) {
+        return NULL;
+    }
+
+    unsigned char* ptr = storage + storage_used + CARP_BLOCK_HEADER;
+    *(size_t*)(ptr - CARP_BLOCK_HEADER) = size;
+    storage_used += CARP_BLOCK_HEADER + CARP_ALIGN(size);
+    storage_last = ptr;
+
+    return ptr;
+}
+
+void* carp_calloc(
+    size_t count,
+    size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void* ptr = carp_malloc(count * size);
+    if (ptr) {
+        (void)memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+void* carp_realloc(
+    void* ptr,
+    size_t size)
+{
+    if (ptr == NULL) {
+        return carp_malloc(size);
+    }
+
+    if (ptr == storage_last) {
+        size_t offset = storage_last - storage;
+        if (size <= storage_size && CARP_ALIGN(size) <= storage_size - offset) {
+            *(size_t*)(storage_last - CARP_BLOCK_HEADER) = size;
+            storage_used = offset + CARP_ALIGN(size);
+            return ptr;
+        }
+        return NULL;
+    }
+
+    void* mem = carp_malloc(size);
+    if (mem) {
+        size_t old_size = block_size(ptr);
+        (void)memcpy(mem, ptr, old_size < size ? old_size : size);
+    }
+
+    return mem;
+}
+
+void carp_free(
+    void* ptr)
+{
+    if (ptr != NULL && ptr == storage_last) {
+        storage_used = storage_last - CARP_BLOCK_HEADER - storage;
+        storage_last = NULL;
+    }
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+// The subset of libc used by carp.
+// With CARP_FREESTANDING, these are implemented in carp_libc.c instead: memory comes from the
+//  storage passed to carp_set_storage(), and only '%s' conversions are formatted.
+// mem* functions are still used directly; a freestanding environment must provide them anyway.
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef CARP_FREESTANDING
+size_t carp_strlen(
+    const char* s);
+
+int carp_strcmp(
+    const char* a,
+    const char* b);
+
+int carp_strncmp(
+    const char* a,
+    const char* b,
+    size_t n);
+
+char* carp_strchr(
+    const char* s,
+    int c);
+
+int carp_snprintf(
+    char* buf,
+    size_t size,
+    const char* fmt,
+    ...);
+
+void* carp_malloc(
+    size_t size);
+
+void* carp_calloc(
+    size_t count,
+    size_t size);
+
+void* carp_realloc(
+    void* ptr,
+    size_t size);
+
+void carp_free(
+    void* ptr);
+#else
+#include <stdio.h>
+#include <stdlib.h>
+
+#define carp_strlen strlen
+#define carp_strcmp strcmp
+#define carp_strncmp strncmp
+#define carp_strchr strchr
+#define carp_snprintf snprintf
+#define carp_malloc malloc
+#define carp_calloc calloc
+#define carp_realloc realloc
+#define carp_free free
+#endif
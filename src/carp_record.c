@@ -0,0 +1,221 @@
+// ftruncate(), pwrite() and mmap() are POSIX, not ISO C
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "carp_record.h"
+#include "carp_backend.h"
+#include "carp_libc.h"
+
+#ifndef CARP_FREESTANDING
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CARP_RECORD_INIT_CAP 25
+
+void carp_record_init(
+    struct CarpRecord* record)
+{
+    record->entries = NULL;
+    record->entry_count = 0;
+    record->entry_capacity = 0;
+    record->blob_size = 0;
+    record->positional_count = 0;
+    record->arguments.buf = NULL;
+    record->failed = carp_vector_init(&record->arguments, CARP_RECORD_INIT_CAP);
+}
+
+void carp_record_cleanup(
+    struct CarpRecord* record)
+{
+    carp_free(record->entries);
+    record->entries = NULL;
+    record->entry_count = 0;
+    record->entry_capacity = 0;
+    carp_vector_cleanup(&record->arguments);
+}
+
+static void record_arguments(
+    struct CarpRecord* record,
+    const char** argv,
+    int argc)
+{
+    for (int i = 0; i < argc && !record->failed; i++) {
+        record->failed = carp_vector_push(&record->arguments, argv[i]);
+        record->blob_size += carp_strlen(argv[i]) + 1;
+    }
+}
+
+void carp_record_option(
+    struct CarpRecord* record,
+    unsigned int id,
+    const char** argv,
+    int argc)
+{
+    if (record->failed) {
+        return;
+    }
+
+    if (record->entry_count == record->entry_capacity) {
+        int capacity = record->entry_capacity ? record->entry_capacity * 2 : CARP_RECORD_INIT_CAP;
+        void* mem = carp_realloc(record->entries, capacity * sizeof(struct CarpRecordEntry));
+        if (mem == NULL) {
+            record->failed = 1;
+            return;
+        }
+        record->entries = mem;
+        record->entry_capacity = capacity;
+    }
+
+    struct CarpRecordEntry* entry = &record->entries[record->entry_count++];
+    entry->id = id;
+    entry->argc = argc;
+    entry->first = record->arguments.size;
+
+    record_arguments(record, argv, argc);
+}
+
+void carp_record_positional(
+    struct CarpRecord* record,
+    const char** argv,
+    int argc)
+{
+    record->positional_count += argc;
+    record_arguments(record, argv, argc);
+}
+
+// Writing and mapping records needs POSIX file and memory mapping functions
+#ifndef CARP_FREESTANDING
+int carp_record_write(
+    struct CarpRecord* record,
+    int fd)
+{
+    if (record->failed || record->blob_size > UINT32_MAX) {
+        return 1;
+    }
+
+    size_t entries_size = record->entry_count * sizeof(struct CarpRecordEntry);
+    size_t arguments_size = record->arguments.size * sizeof(uint32_t);
+    size_t size = sizeof(struct CarpRecordHeader) + entries_size + arguments_size + record->blob_size;
+    unsigned char* buf = carp_malloc(size);
+
+    if (buf == NULL) {
+        return 1;
+    }
+
+    struct CarpRecordHeader* header = (struct CarpRecordHeader*)buf;
+    uint32_t* arguments = (uint32_t*)(buf + sizeof(*header) + entries_size);
+    char* blob = (char*)arguments + arguments_size;
+
+    header->magic = CARP_RECORD_MAGIC;
+    header->version = CARP_RECORD_VERSION;
+    header->table_id = carp_backend_table_id();
+    header->entry_count = record->entry_count;
+    header->argument_count = record->arguments.size;
+    header->positional_count = record->positional_count;
+    header->blob_size = record->blob_size;
+
+    if (entries_size > 0) {
+        (void)memcpy(buf + sizeof(*header), record->entries, entries_size);
+    }
+
+    uint32_t offset = 0;
+    for (int i = 0; i < record->arguments.size; i++) {
+        size_t len = carp_strlen(record->arguments.buf[i]) + 1;
+        (void)memcpy(blob + offset, record->arguments.buf[i], len);
+        arguments[i] = offset;
+        offset += len;
+    }
+
+    int error = ftruncate(fd, size) != 0;
+    for (size_t written = 0; !error && written < size;) {
+        ssize_t n = pwrite(fd, buf + written, size - written, written);
+        if (n <= 0) {
+            error = 1;
+        }
+        else {
+            written += n;
+        }
+    }
+
+    carp_free(buf);
+    return error;
+}
+
+// Check that every count and offset in the record stays within its 'size' bytes
+static int record_valid(
+    const struct CarpRecordView* view,
+    uint64_t size)
+{
+    const struct CarpRecordHeader* header = view->header;
+    uint64_t expected = sizeof(*header) +
+        (uint64_t)header->entry_count * sizeof(struct CarpRecordEntry) +
+        (uint64_t)header->argument_count * sizeof(uint32_t) +
+        header->blob_size;
+
+    if (header->magic != CARP_RECORD_MAGIC ||
+        header->version != CARP_RECORD_VERSION ||
+        header->table_id != carp_backend_table_id() ||
+        expected > size ||
+        header->positional_count > header->argument_count ||
+        (header->blob_size > 0 && view->blob[header->blob_size - 1] != '\0'))
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        const struct CarpRecordEntry* entry = &view->entries[i];
+        if (entry->id >= (uint32_t)carp_backend_option_count() ||
+            (uint64_t)entry->first + entry->argc > header->argument_count - header->positional_count)
+        {
+            return 0;
+        }
+
+        // Callbacks rely on getting as many arguments as their option takes
+        const struct CarpOptionSpec* spec = carp_backend_spec(entry->id);
+        if (spec->arguments >= 0 && entry->argc != (uint32_t)spec->arguments) {
+            return 0;
+        }
+    }
+
+    for (uint32_t i = 0; i < header->argument_count; i++) {
+        if (view->arguments[i] >= header->blob_size) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int carp_record_map(
+    int fd,
+    struct CarpRecordView* view)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) || (uint64_t)st.st_size < sizeof(struct CarpRecordHeader)) {
+        return 1;
+    }
+
+    void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        return 1;
+    }
+
+    view->header = mem;
+    view->entries = (const struct CarpRecordEntry*)(view->header + 1);
+    view->arguments = (const uint32_t*)(view->entries + view->header->entry_count);
+    view->blob = (const char*)(view->arguments + view->header->argument_count);
+
+    if (!record_valid(view, st.st_size)) {
+        (void)munmap(mem, st.st_size);
+        return 1;
+    }
+
+    // The mapping is never released: like argv, the arguments handed to callbacks
+    //  and the non-option arguments point into it for the rest of the program.
+    return 0;
+}
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "carp_argument_vector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CARP_RECORD_MAGIC 0x50524143u // "CARP"
+#define CARP_RECORD_VERSION 1u
+
+// A parse result, as written by carp_parse_save() and read back by carp_load_parsed().
+// The layout only holds offsets, so it can be used at whatever address it is mapped:
+//
+//  struct CarpRecordHeader
+//  struct CarpRecordEntry   entries[entry_count]      (one per option occurrence, in order)
+//  uint32_t                 arguments[argument_count] (offsets into the blob)
+//  char                     blob[blob_size]           (NUL terminated strings)
+//
+// The arguments of entry i are arguments[first .. first + argc), and the non-option
+//  arguments are the last 'positional_count' arguments.
+struct CarpRecordHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t table_id;
+    uint32_t entry_count;
+    uint32_t argument_count;
+    uint32_t positional_count;
+    uint32_t blob_size;
+};
+
+struct CarpRecordEntry {
+    uint32_t id;
+    uint32_t argc;
+    uint32_t first;
+};
+
+// Collects a record while the command line is parsed
+struct CarpRecord {
+    struct CarpRecordEntry* entries;
+    int entry_count;
+    int entry_capacity;
+
+    // Arguments of every entry, followed by the non-option arguments
+    struct CarpArgumentVector arguments;
+    size_t blob_size;
+
+    int positional_count;
+    int failed;
+};
+
+// A record mapped into memory, checked against the current option table
+struct CarpRecordView {
+    const struct CarpRecordHeader* header;
+    const struct CarpRecordEntry* entries;
+    const uint32_t* arguments;
+    const char* blob;
+};
+
+void carp_record_init(
+    struct CarpRecord* record);
+
+void carp_record_cleanup(
+    struct CarpRecord* record);
+
+void carp_record_option(
+    struct CarpRecord* record,
+    unsigned int id,
+    const char** argv,
+    int argc);
+
+void carp_record_positional(
+    struct CarpRecord* record,
+    const char** argv,
+    int argc);
+
+int carp_record_write(
+    struct CarpRecord* record,
+    int fd);
+
+int carp_record_map(
+    int fd,
+    struct CarpRecordView* view);
@@ -0,0 +1,29 @@
+#pragma once
+
+// Static tracepoints (USDT) under the "carp" provider, for bpftrace and perf.
+// Only compiled in with CARP_ENABLE_TRACING. Each probe is then a single nop until a tracer
+//  attaches to it; its arguments are values already at hand, so nothing is computed for it.
+// Callbacks are identified by option id (the option's position in the JSON files, counting
+//  across files), since looking up the name would cost a call on every callback.
+//
+//  parse__start     (int argc, char** argv)
+//  parse__end       (int non-option argument count)
+//  token            (const char* token, int CarpTokenType)
+//  search           (const char* name, int len, int hit) - 'name' is not NUL terminated
+//  callback__enter  (unsigned int option id, int argc)
+//  callback__exit   (unsigned int option id)
+//  error            (int CarpError, const char* message)
+//
+// See src/trace/ for sample scripts.
+
+#ifdef CARP_TRACE
+#include <sys/sdt.h>
+
+#define CARP_TRACE1(name, a) DTRACE_PROBE1(carp, name, a)
+#define CARP_TRACE2(name, a, b) DTRACE_PROBE2(carp, name, a, b)
+#define CARP_TRACE3(name, a, b, c) DTRACE_PROBE3(carp, name, a, b, c)
+#else
+#define CARP_TRACE1(name, a)
+#define CARP_TRACE2(name, a, b)
+#define CARP_TRACE3(name, a, b, c)
+#endif
@@ -3,16 +3,60 @@ Made with version: Python 3.11.2
 '''
 
 import json
+import re
 import sys
+import hashlib
 from shutil import which
 import os
-from os.path import dirname, realpath, join
+from os.path import dirname, realpath, join, exists, basename, splitext
+
+def carp_json_clean_arguments(arguments):
+    # The generated tables store the argument count in a signed char
+    if arguments < -1 or arguments > 127:
+        exit_with_error("json field 'arguments' must be between -1 and 127 ('arguments: {}')".format(arguments))
+    return arguments
+
+def carp_json_clean_option_names(field):
+    def clean(names):
+        for v in names:
+            if not isinstance(v, str) or not v.strip("-"):
+                exit_with_error("json field '{}' must be a list of option names ('{}: {}')".format(field, field, names))
+        return [v.strip("-") for v in names]
+    return clean
+
+def carp_json_clean_repeat(repeat):
+    if repeat not in ("each", "aggregate"):
+        exit_with_error("json field 'repeat' must be \"each\" or \"aggregate\" ('repeat: {}')".format(repeat))
+    return repeat
+
+def carp_json_clean_weight(weight):
+    if weight < 0:
+        exit_with_error("json field 'weight' must not be negative ('weight: {}')".format(weight))
+    return weight
 
 CARP_JSON_OPTION_SCHEMA = {
-    "arguments": { "type": int, "default": "false", "required": True, "clean": None },
-    "callback": { "type": str, "default": "null", "required": True, "clean": None }
+    "arguments": { "type": int, "default": "false", "required": True, "clean": carp_json_clean_arguments },
+    "callback": { "type": str, "default": "null", "required": True, "clean": None },
+    "async": { "type": bool, "default": False, "required": False, "clean": None },
+    "after": { "type": list, "default": [], "required": False, "clean": carp_json_clean_option_names("after") },
+    "repeat": { "type": str, "default": "each", "required": False, "clean": carp_json_clean_repeat },
+    "required": { "type": bool, "default": False, "required": False, "clean": None },
+    "conflicts": { "type": list, "default": [], "required": False, "clean": carp_json_clean_option_names("conflicts") },
+    "requires": { "type": list, "default": [], "required": False, "clean": carp_json_clean_option_names("requires") },
+    "weight": { "type": (int, float), "default": 0, "required": False, "clean": carp_json_clean_weight }
 }
 
+# Number of table rows formatted and written per call to write().
+# Joining rows into chunks avoids a write() per line when emitting very large tables.
+CARP_EMIT_CHUNK_SIZE = 1024
+
+# Number of options checked ahead of the main table, picked by weight.
+CARP_HOT_OPTION_COUNT = 8
+
+# First line of every generated source file. Holds a hash of the normalized option table,
+#  which lets a subsequent run skip regenerating (and CMake skip recompiling) unchanged output.
+CARP_SPEC_HASH_HEADER = "/* carp-spec-hash: {} */\n"
+
 def exit_with_error(msg, status_code=1):
     print("[carp] " + msg, file=sys.stderr)
     exit(status_code)
@@ -101,7 +145,8 @@ def carp_json_option_validate(option):
     return options_clean
 
 carp_table = []
-def carp_table_add_option(option, spec):
+carp_table_names = {}
+def carp_table_add_option(option, spec, source=None):
     '''
     Adds a new option to the carp table.
     Exit if the provided option already exists.
@@ -113,16 +158,454 @@ def carp_table_add_option(option, spec):
     spec : dict
         A dictionary containing metadata about the option.
         Valid fields are listed in 'CARP_JSON_OPTION_SCHEMA'
+    source : str
+        The json file which defines the option, used to report conflicts between files
     '''
-    for v in carp_table:
-        if v["name"] == option:
-            exit_with_error("option '{}' specified more than once".format(option))
+    if option in carp_table_names:
+        if source is not None and carp_table_names[option] != source:
+            exit_with_error("option '{}' is defined in both {} and {}".format(option, carp_table_names[option], source))
+        exit_with_error("option '{}' specified more than once".format(option))
+    carp_table_names[option] = source
     carp_table.append({"name": option} | spec)
 
-def carp_gperf_generate_hash(carp_table, output_dir):
+def carp_table_resolve_async(carp_table):
+    '''
+    Assign each option its async level from the dependencies declared in "after".
+    An option without dependencies has level 0. Otherwise, its level is one greater than
+    the highest level among the async options it depends on, so that running the levels in
+    increasing order respects every declared dependency.
+    Exit if a dependency is unknown, is declared by a synchronous option, or forms a cycle.
+
+    Parameters
+    ----------
+    carp_table : list
+        A list of dictionaries, where each element is an option
+    '''
+    by_name = { v["name"]: v for v in carp_table }
+    by_id = {}
+    for v in carp_table:
+        by_id.setdefault(v["id"], v)
+
+    for v in by_id.values():
+        if v["after"] and not v["async"]:
+            exit_with_error("option '{}': json field 'after' requires 'async' to be true".format(v["name"]))
+        for dep in v["after"]:
+            if dep not in by_name:
+                exit_with_error("option '{}': unknown option '{}' in json field 'after'".format(v["name"], dep))
+
+    levels = {}
+    visiting = set()
+    def level(option_id):
+        if option_id in levels:
+            return levels[option_id]
+        if option_id in visiting:
+            exit_with_error("option '{}': json field 'after' forms a cycle".format(by_id[option_id]["name"]))
+        visiting.add(option_id)
+        deps = [by_name[dep] for dep in by_id[option_id]["after"]]
+        if deps:
+            levels[option_id] = 1 + max([level(d["id"]) if d["async"] else 0 for d in deps])
+        else:
+            levels[option_id] = 0
+        visiting.remove(option_id)
+        if levels[option_id] > 0xff:
+            exit_with_error("option '{}': json field 'after' nests too deeply".format(by_id[option_id]["name"]))
+        return levels[option_id]
+
+    sys.setrecursionlimit(max(sys.getrecursionlimit(), 2 * len(by_id) + 100))
+    for v in carp_table:
+        v["level"] = level(v["id"])
+
+def carp_table_resolve_constraints(carp_table):
+    '''
+    Replace the option names listed in "conflicts" and "requires" with option ids.
+    Exit if a name is unknown or an option refers to itself.
+
+    Parameters
+    ----------
+    carp_table : list
+        A list of dictionaries, where each element is an option
+    '''
+    by_name = { v["name"]: v for v in carp_table }
+    resolved = {}
+    for v in carp_table:
+        if v["id"] not in resolved:
+            resolved[v["id"]] = {}
+            for field in ("conflicts", "requires"):
+                ids = set()
+                for name in v[field]:
+                    if name not in by_name:
+                        exit_with_error("option '{}': unknown option '{}' in json field '{}'".format(v["name"], name, field))
+                    if by_name[name]["id"] == v["id"]:
+                        exit_with_error("option '{}': json field '{}' refers to the option itself".format(v["name"], field))
+                    ids.add(by_name[name]["id"])
+                resolved[v["id"]][field] = sorted(ids)
+        v |= resolved[v["id"]]
+
+def carp_read_profile(profile_file):
+    '''
+    Read a profile of option lookups, as recorded by a build with CARP_ENABLE_PROFILING.
+    Each line holds an option name, optionally followed by a count (e.g.: 'verbose 120').
+
+    Returns
+    -------
+    dict
+        The number of lookups of each option name
+    '''
+    counts = {}
+    with open(profile_file, "r") as f:
+        for line in f:
+            fields = line.split()
+            if not fields:
+                continue
+            try:
+                count = int(fields[1]) if len(fields) > 1 else 1
+            except ValueError:
+                exit_with_error("invalid line in profile {}: '{}'".format(profile_file, line.strip()))
+            name = fields[0].lstrip("-")
+            counts[name] = counts.get(name, 0) + count
+    return counts
+
+def carp_table_apply_profile(carp_table, counts):
+    '''
+    Add the profiled lookup counts to the weight of each option name.
+    '''
+    for v in carp_table:
+        v["weight"] = v["weight"] + counts.get(v["name"], 0)
+
+def carp_hot_options(carp_table):
+    '''
+    Return the (at most CARP_HOT_OPTION_COUNT) options with the highest positive weight,
+    heaviest first. Ties are broken by name so the output is stable.
+    '''
+    weighted = [v for v in carp_table if v["weight"] > 0]
+    return sorted(weighted, key=lambda v: (-v["weight"], v["name"]))[:CARP_HOT_OPTION_COUNT]
+
+def carp_write_hot(f, carp_table):
+    '''
+    Write 'carp_hot()', which checks the heaviest options before the main table is searched.
+    Candidates are dispatched on length and then compared directly, heaviest first.
+
+    Returns
+    -------
+    bool
+        True if any option has a weight (and so 'carp_hot()' was written)
+    '''
+    hot = carp_hot_options(carp_table)
+    if not hot:
+        return False
+
+    by_len = {}
+    for v in hot:
+        by_len.setdefault(len(v["name"].encode()), []).append(v)
+
+    f.write("static const struct CarpOptionSpec* carp_hot(const char* name, int len) {\n")
+    f.write("\tswitch (len) {\n")
+    for length in sorted(by_len):
+        f.write("\t\tcase {}:\n".format(length))
+        for v in by_len[length]:
+            f.write("\t\t\tif (!memcmp(name, \"{}\", {})) return &carp_specs[{}];\n".format(v["name"], length, v["id"]))
+        f.write("\t\t\tbreak;\n")
+    f.write("\t}\n")
+    f.write("\treturn NULL;\n")
+    f.write("}\n\n")
+    return True
+
+def carp_table_hash(carp_table, implementation):
+    '''
+    Compute a hash of the normalized option table.
+    The table is sorted by option name, so the hash only depends on the options' fields.
+    Those include the option ids (and thereby the aggregate slots), which follow the order
+    of the json file, so reordering options does change the hash. The generator script
+    itself is also hashed, so that changes to the emitted code invalidate previously
+    generated output.
+
+    Parameters
+    ----------
+    carp_table : list
+        A list of dictionaries, where each element is an option
+    implementation : str
+        The selected backend ("hash" or "search")
+
+    Returns
+    -------
+    str
+        Hex digest of the normalized table (including weights, since they affect the layout)
+    '''
+    h = hashlib.sha256()
+    h.update(implementation.encode())
+    with open(realpath(__file__), "rb") as f:
+        h.update(f.read())
+    normalized = sorted(carp_table, key=lambda v: v["name"])
+    h.update(json.dumps(normalized, sort_keys=True, separators=(",", ":")).encode())
+    return h.hexdigest()
+
+def carp_output_is_current(output_path, spec_hash):
+    '''
+    Return True if 'output_path' exists and was generated from a table with hash 'spec_hash'.
+    The generators write to a temporary file and move it into place once it is complete,
+    so a file carrying the header is never a partial one.
+    '''
+    if not exists(output_path):
+        return False
+    with open(output_path, "r") as f:
+        return f.readline() == CARP_SPEC_HASH_HEADER.format(spec_hash)
+
+def carp_write_if_changed(path, content):
+    '''
+    Write 'content' to 'path', unless the file already holds exactly that content.
+    '''
+    if exists(path):
+        with open(path, "r") as f:
+            if f.read() == content:
+                return
+    with open(path, "w") as f:
+        f.write(content)
+
+def carp_write_chunked(f, rows):
+    '''
+    Write an iterable of formatted table rows to 'f', CARP_EMIT_CHUNK_SIZE rows at a time.
+    '''
+    chunk = []
+    for row in rows:
+        chunk.append(row)
+        if len(chunk) == CARP_EMIT_CHUNK_SIZE:
+            f.write("".join(chunk))
+            chunk.clear()
+    if chunk:
+        f.write("".join(chunk))
+
+def c_uint_type(max_value):
+    '''
+    Return the narrowest unsigned C type which can hold 'max_value'.
+    '''
+    if max_value <= 0xff:
+        return "uint8_t"
+    elif max_value <= 0xffff:
+        return "uint16_t"
+    else:
+        return "uint32_t"
+
+def carp_table_specs(carp_table):
+    '''
+    Collect the option specs and callbacks referenced by the carp table.
+    Options share a spec when they come from the same json option (e.g.: '-f' and '--file').
+
+    Parameters
+    ----------
+    carp_table : list
+        A list of dictionaries, where each element is an option
+
+    Returns
+    -------
+    specs
+        A list of option dictionaries, indexed by option id
+    callbacks
+        A sorted list of unique callback names; a spec refers to its callback by index into this list
+    '''
+    by_id = {}
+    for v in carp_table:
+        by_id.setdefault(v["id"], v)
+    specs = [by_id[k] for k in sorted(by_id)]
+    callbacks = sorted(set([v["callback"] for v in specs]))
+    if len(callbacks) > 0xffff:
+        exit_with_error("too many distinct callbacks ({})".format(len(callbacks)))
+    return specs, callbacks
+
+def carp_write_specs(f, specs, callbacks, spec_hash):
+    '''
+    Write the callback table and the table of option specs.
+    The specs only hold integers, so the only relocations left in the generated tables
+    are the ones for 'carp_callbacks', one per distinct callback function.
+    Aggregated options are given consecutive slots, in the order they appear in the json file.
+    'carp_table_id' is taken from the table hash, so records written by carp_parse_save()
+    are only replayed by programs built from the same table.
+    '''
+    callback_index = { v: i for i, v in enumerate(callbacks) }
+    aggregates = [v["id"] for v in specs if v["repeat"] == "aggregate"]
+    if len(aggregates) > 0xffff:
+        exit_with_error("too many aggregated options ({})".format(len(aggregates)))
+    slot = { v: i for i, v in enumerate(aggregates) }
+
+    def flags(v):
+        flags = []
+        if v["async"]:
+            flags.append("CARP_SPEC_ASYNC")
+        if v["repeat"] == "aggregate":
+            flags.append("CARP_SPEC_AGGREGATE")
+        return " | ".join(flags) if flags else "0"
+
+    carp_write_chunked(f, ("extern void {}(void*, const char**, int);\n".format(v) for v in callbacks))
+    f.write("\n")
+
+    f.write("const CARP_CALLBACK carp_callbacks[{}] = {{\n".format(len(callbacks)))
+    carp_write_chunked(f, ("\t{},\n".format(v) for v in callbacks))
+    f.write("};\n\n")
+
+    f.write("static const struct CarpOptionSpec carp_specs[{}] = {{\n".format(len(specs)))
+    carp_write_chunked(f, (
+        "\t{{ .arguments = {}, .flags = {}, .level = {}, .callback = {}, .slot = {}, .id = {} }},\n".format(
+            v["arguments"], flags(v), v["level"], callback_index[v["callback"]], slot.get(v["id"], 0), v["id"])
+        for v in specs))
+    f.write("};\n\n")
+
+    f.write("const struct CarpOptionSpec* carp_option_spec(unsigned int id) {\n")
+    f.write("\treturn &carp_specs[id];\n")
+    f.write("}\n\n")
+
+    f.write("const int carp_aggregate_count = {};\n".format(len(aggregates)))
+    f.write("const uint64_t carp_table_id = UINT64_C(0x{});\n\n".format(spec_hash[:16]))
+
+def carp_write_completions(f, carp_table):
+    '''
+    Write the table used by '--carp-complete': every option flag as typed on the
+    command line (e.g.: '-f' and '--file'), sorted bytewise so that the flags starting
+    with a given prefix form a contiguous range.
+    '''
+    flags = sorted((("-" if len(v["name"]) == 1 else "--") + v["name"] for v in carp_table), key=lambda n: n.encode())
+    offsets = []
+    offset = 0
+    for n in flags:
+        offsets.append(offset)
+        offset += len(n.encode()) + 1
+
+    f.write("const int carp_completion_count = {};\n\n".format(len(flags)))
+
+    f.write("static const char carp_completion_flags[] =\n")
+    carp_write_chunked(f, ("\t\"{}\\0\"\n".format(n) for n in flags))
+    f.write("\t;\n\n")
+
+    f.write("static const {} carp_completion_offsets[{}] = {{\n".format(c_uint_type(offset), len(flags)))
+    carp_write_chunked(f, ("\t{},\n".format(v) for v in offsets))
+    f.write("};\n\n")
+
+    f.write("const char* carp_completion(int i) {\n")
+    f.write("\treturn carp_completion_flags + carp_completion_offsets[i];\n")
+    f.write("}\n\n")
+
+def carp_generate_completion_scripts(program, output_dir):
+    '''
+    Generate bash and zsh completion scripts for 'program'.
+    Both scripts ask the program itself for matching flags through '--carp-complete <prefix>',
+    which carp answers from the generated completion table before any callback runs.
+    '''
+    function = "_carp_complete_" + re.sub(r"[^A-Za-z0-9_]", "_", program)
+
+    bash = "\n".join([
+        "# bash completion for {}, generated by carp".format(program),
+        "{}() {{".format(function),
+        "    local cur=\"${COMP_WORDS[COMP_CWORD]}\"",
+        "    if [[ \"$cur\" == -* ]]; then",
+        "        COMPREPLY=( $(\"${COMP_WORDS[0]}\" --carp-complete \"$cur\" 2>/dev/null) )",
+        "    fi",
+        "}",
+        "complete -o default -F {} {}".format(function, program),
+        ""])
+
+    zsh = "\n".join([
+        "#compdef {}".format(program),
+        "# zsh completion for {}, generated by carp".format(program),
+        "{}() {{".format(function),
+        "    if [[ \"$PREFIX\" == -* ]]; then",
+        "        local -a flags",
+        "        flags=(${(f)\"$(${words[1]} --carp-complete \"$PREFIX\" 2>/dev/null)\"})",
+        "        compadd -Q -- $flags",
+        "    else",
+        "        _files",
+        "    fi",
+        "}",
+        "compdef {} {}".format(function, program),
+        ""])
+
+    carp_write_if_changed(join(output_dir, "carp_completion.bash"), bash)
+    carp_write_if_changed(join(output_dir, "carp_completion.zsh"), zsh)
+
+def carp_option_display_names(carp_table):
+    '''
+    Return the name used in messages for each option id, e.g.: '--file' (preferred) or '-f'.
+    '''
+    names = {}
+    for v in carp_table:
+        if len(v["name"]) > len(names.get(v["id"], "")):
+            names[v["id"]] = v["name"]
+    return ["-" + n if len(n) == 1 else "--" + n for _, n in sorted(names.items())]
+
+def carp_constraint_mask(ids):
+    '''
+    Build the bitset mask for a list of option ids.
+
+    Returns
+    -------
+    (word, words)
+        The index of the first word covered by the mask, and the value of each covered word
+    '''
+    first = min(ids) // 64
+    words = [0] * (max(ids) // 64 - first + 1)
+    for i in ids:
+        words[i // 64 - first] |= 1 << (i % 64)
+    return first, words
+
+def carp_write_constraints(f, carp_table, specs):
+    '''
+    Write the option names and the masks for the "required", "conflicts" and "requires" relations.
+    Each option's bit in the bitset of seen options is its id.
+    '''
+    names = carp_option_display_names(carp_table)
+    offsets = []
+    offset = 0
+    for n in names:
+        offsets.append(offset)
+        offset += len(n.encode()) + 1
+
+    f.write("const int carp_option_count = {};\n\n".format(len(specs)))
+
+    # Each name is its own literal, so that '\\0' is never followed by a digit
+    f.write("static const char carp_option_names[] =\n")
+    carp_write_chunked(f, ("\t\"{}\\0\"\n".format(n) for n in names))
+    f.write("\t;\n\n")
+
+    f.write("static const {} carp_option_name_offsets[{}] = {{\n".format(c_uint_type(offset), len(names)))
+    carp_write_chunked(f, ("\t{},\n".format(v) for v in offsets))
+    f.write("};\n\n")
+
+    f.write("const char* carp_option_name(unsigned int id) {\n")
+    f.write("\treturn carp_option_names + carp_option_name_offsets[id];\n")
+    f.write("}\n\n")
+
+    constraints = []
+    masks = []
+    def add(kind, option, ids):
+        word, words = carp_constraint_mask(ids)
+        constraints.append((kind, option, word, len(words), len(masks)))
+        masks.extend(words)
+
+    required = [v["id"] for v in specs if v["required"]]
+    if required:
+        add("CARP_CONSTRAINT_REQUIRED", 0, required)
+    for v in specs:
+        if v["conflicts"]:
+            add("CARP_CONSTRAINT_CONFLICTS", v["id"], v["conflicts"])
+        if v["requires"]:
+            add("CARP_CONSTRAINT_REQUIRES", v["id"], v["requires"])
+
+    # Arrays can't be empty, so pad them with an entry that's never read
+    f.write("const uint64_t carp_constraint_masks[{}] = {{\n".format(max(len(masks), 1)))
+    carp_write_chunked(f, ("\t0x{:016x},\n".format(v) for v in (masks or [0])))
+    f.write("};\n\n")
+
+    f.write("const struct CarpConstraint carp_constraints[{}] = {{\n".format(max(len(constraints), 1)))
+    carp_write_chunked(f, (
+        "\t{{ .type = {}, .option = {}, .word = {}, .words = {}, .mask = {} }},\n".format(*v)
+        for v in (constraints or [("0", 0, 0, 0, 0)])))
+    f.write("};\n\n")
+
+    f.write("const int carp_constraint_count = {};\n\n".format(len(constraints)))
+
+def carp_gperf_generate_hash(carp_table, output_dir, spec_hash):
     '''
     Attempt to generate a perfect hash function implementation in C using gperf.
     Exit if gperf is unable to generate a hash function.
+    gperf is run with '-P' so option names live in a single string pool and the
+    keyword table holds offsets into it instead of pointers.
 
     Parameters
     ----------
@@ -130,101 +613,230 @@ def carp_gperf_generate_hash(carp_table, output_dir):
         A list of dictionaries, where each element is an option
     output_dir : str
         The absolute path to directory where the output files will be placed
+    spec_hash : str
+        Hash of the normalized option table, written to the head of the output file
     '''
     gperf_input_abs_path = realpath(join(output_dir, "gperf_input.txt"))
     gperf_output_abs_path = realpath(join(output_dir, "carp_hash.c"))
+    gperf_tmp_abs_path = gperf_output_abs_path + ".tmp"
     max_option_name_len = len(max([v["name"] for v in carp_table], key=len))
+    specs, callbacks = carp_table_specs(carp_table)
     with open(gperf_input_abs_path, "w") as f:
         f.write("%{\n")
         f.write("#include \"carp_backend.h\"\n")
         f.write("#include <stdbool.h>\n")
+        f.write("#include <stdint.h>\n")
         f.write("#include <string.h>\n")
-        f.write("struct CarpOption* in_word_set(register const char *str, register size_t len);\n")
+        f.write("struct CarpHashOption;\n")
+        f.write("const struct CarpHashOption* in_word_set(register const char *str, register size_t len);\n\n")
 
-        callbacks = set([v["callback"] for v in carp_table])
-        for v in callbacks:
-            f.write("extern void {}(void*, const char**, int);\n".format(v))
+        carp_write_specs(f, specs, callbacks, spec_hash)
+        carp_write_constraints(f, carp_table, specs)
+        carp_write_completions(f, carp_table)
+        has_hot = carp_write_hot(f, carp_table)
+        f.write("%}\n")
+
+        f.write("struct CarpHashOption {{ int name; {} id; }};\n".format(c_uint_type(len(specs))))
+        f.write("%%\n")
+        carp_write_chunked(f, ("{}, {}\n".format(v["name"], v["id"]) for v in carp_table))
+        f.write("%%\n")
 
-        f.write("struct CarpOptionSpec* carp_hash(const char* name, int len) {\n")
+        f.write("const struct CarpOptionSpec* carp_hash(const char* name, int len) {\n")
+        if has_hot:
+            f.write("\tconst struct CarpOptionSpec* hot = carp_hot(name, len);\n")
+            f.write("\tif (hot) return hot;\n\n")
         f.write("#define CARP_KEY_NAME_SIZE ({} + 1)\n".format(max_option_name_len))
+        f.write("\tif (len >= CARP_KEY_NAME_SIZE) return NULL;\n")
         f.write("\tchar key_name[CARP_KEY_NAME_SIZE];\n")
-        f.write("\t(void)strncpy(key_name, name, len);\n")
+        f.write("\t(void)memcpy(key_name, name, len);\n")
         f.write("\tkey_name[len] = '\\0';\n")
-        f.write("\tstruct CarpOption* opt = in_word_set(key_name, len);\n\n")
+        f.write("\tconst struct CarpHashOption* opt = in_word_set(key_name, len);\n\n")
 
-        f.write("\tif (opt) return &opt->spec;\n")
+        f.write("\tif (opt) return &carp_specs[opt->id];\n")
         f.write("\telse return NULL;\n")
         f.write("}\n")
-        f.write("%}\n")
-
-        f.write("struct CarpOption;\n")
-        f.write("%%\n")
-        for v in carp_table:
-            f.write("{}, {{ {}, {} }}\n".format(v["name"], v["arguments"], v["callback"]))
 
-    gperf_command = "{} -t --output-file={} {}".format(which("gperf"), gperf_output_abs_path, gperf_input_abs_path)
+    gperf_command = "{} -t -C -P --output-file={} {}".format(which("gperf"), gperf_tmp_abs_path, gperf_input_abs_path)
     if os.system(gperf_command):
         exit_with_error("error executing gperf command: {}".format(gperf_command))
 
-def carp_generate_search(carp_table, output_dir):
-    def sort_carp_table(carp_table_unsorted):
-        names_unsorted = [ v["name"] for v in carp_table_unsorted ]
-        names_sorted = sorted(names_unsorted)
-        carp_table_sorted = []
-        for n in names_sorted:
-            idx = names_unsorted.index(n)
-            carp_table_sorted.append(carp_table_unsorted[idx])
-        return carp_table_sorted
-
-    ct_sorted = sort_carp_table(carp_table)
-    search_output_abs_path = realpath(join(output_dir, "carp_search.c"))
-    max_option_name_len = len(max([v["name"] for v in ct_sorted], key=len))
-    with open(search_output_abs_path, "w") as f:
-        f.write("#include \"carp_backend.h\"\n")
-        f.write("#include <string.h>\n")
-        f.write("#include <stdlib.h>\n\n")
+    # Prefix the gperf output with the table hash so unchanged specs can be detected next time.
+    # Only a complete file may carry the hash header, see carp_output_is_current().
+    gperf_hashed_abs_path = gperf_output_abs_path + ".hashed"
+    with open(gperf_tmp_abs_path, "r") as src, open(gperf_hashed_abs_path, "w") as dst:
+        dst.write(CARP_SPEC_HASH_HEADER.format(spec_hash))
+        dst.write(src.read())
+    os.remove(gperf_tmp_abs_path)
+    os.replace(gperf_hashed_abs_path, gperf_output_abs_path)
 
-        callbacks = set([v["callback"] for v in ct_sorted])
-        for v in callbacks:
-            f.write("extern void {}(void*, const char**, int);\n".format(v))
-        f.write("\n")
+def carp_key_prefix(name):
+    '''
+    Pack the first 8 bytes of 'name' into an integer, most significant byte first.
+    Names shorter than 8 bytes are zero padded, so comparing two prefixes as integers
+    orders them the same way strcmp() would order the names they came from.
+    '''
+    return int.from_bytes(name.encode()[:8].ljust(8, b"\0"), "big")
 
-        f.write("int compare_options(const void* lhs, const void* rhs) {\n")
-        f.write("\treturn strcmp(((struct CarpOption*)lhs)->name, ((struct CarpOption*)rhs)->name);\n")
-        f.write("}\n\n")
+def carp_eytzinger_order(sorted_list):
+    '''
+    Reorder a sorted list into Eytzinger (breadth-first binary tree) order.
+    The returned list is 1-based: index 0 holds None, and the children of node k are 2k and 2k+1.
+    '''
+    n = len(sorted_list)
+    out = [None] * (n + 1)
+    it = iter(sorted_list)
+    def build(k):
+        if k <= n:
+            build(2 * k)
+            out[k] = next(it)
+            build(2 * k + 1)
+    build(1)
+    return out
+
+def carp_generate_search(carp_table, output_dir, spec_hash):
+    '''
+    Generate the search backend.
+    The table is laid out as a structure of arrays in Eytzinger order, so the search walks
+    down an implicit binary tree and each level touches only the array of 8-byte key prefixes.
+    The rest of each name (past the first 8 bytes) is kept in a single string pool and is only
+    compared when two prefixes tie. None of the arrays hold pointers.
 
-        f.write("struct CarpOptionSpec* carp_search(const char* name, int len) {\n")
-        f.write("\tstatic struct CarpOption opts[{}] = {{\n".format(len(ct_sorted)))
-        for i, v in enumerate(ct_sorted):
-            f.write("\t\t[{}] = {{\n".format(i))
-            f.write("\t\t\t.name = \"{}\",\n".format(ct_sorted[i]["name"]))
-            f.write("\t\t\t.spec = {\n")
-            f.write("\t\t\t\t.arguments = {},\n".format(ct_sorted[i]["arguments"]))
-            f.write("\t\t\t\t.callback = {}\n".format(ct_sorted[i]["callback"]))
-            f.write("\t\t\t}\n")
-            f.write("\t\t},\n")
-        f.write("\t};\n\n")
+    Parameters
+    ----------
+    carp_table : list
+        A list of dictionaries, where each element is an option
+    output_dir : str
+        The absolute path to directory where the output files will be placed
+    spec_hash : str
+        Hash of the normalized option table, written to the head of the output file
+    '''
+    ct_sorted = sorted(carp_table, key=lambda v: v["name"].encode())
+    ct_eytzinger = carp_eytzinger_order(ct_sorted)
+    option_count = len(ct_sorted)
+    max_option_name_len = len(max([v["name"].encode() for v in ct_sorted], key=len))
+    specs, callbacks = carp_table_specs(carp_table)
+
+    # Only the bytes past the key prefix need to be stored
+    pool = []
+    pool_offsets = []
+    pool_len = 0
+    for v in ct_eytzinger[1:]:
+        suffix = v["name"][8:]
+        pool_offsets.append(pool_len if suffix else 0)
+        if suffix:
+            pool.append(suffix)
+            pool_len += len(suffix.encode())
 
-        f.write("#define CARP_KEY_NAME_SIZE ({} + 1)\n".format(max_option_name_len))
-        f.write("\tchar key_name[CARP_KEY_NAME_SIZE];\n")
-        f.write("\t(void)strncpy(key_name, name, len);\n")
-        f.write("\tkey_name[len] = '\\0';\n")
-        f.write("\tstruct CarpOption key = { .name = key_name };\n\n")
+    search_output_abs_path = realpath(join(output_dir, "carp_search.c"))
+    search_tmp_abs_path = search_output_abs_path + ".tmp"
+    with open(search_tmp_abs_path, "w") as f:
+        f.write(CARP_SPEC_HASH_HEADER.format(spec_hash))
+        f.write("#include \"carp_backend.h\"\n")
+        f.write("#include <stddef.h>\n")
+        f.write("#include <stdint.h>\n")
+        f.write("#include <string.h>\n\n")
+
+        carp_write_specs(f, specs, callbacks, spec_hash)
+        carp_write_constraints(f, carp_table, specs)
+        carp_write_completions(f, carp_table)
+
+        f.write("#define CARP_OPTION_COUNT {}\n\n".format(option_count))
+
+        f.write("static const char carp_pool[{}] =\n".format(pool_len + 1))
+        carp_write_chunked(f, ("\t\"{}\"\n".format("".join(pool[i:i + 16])) for i in range(0, len(pool), 16)))
+        f.write("\t\"\";\n\n")
+
+        # Index 0 of every array is unused; the tree is rooted at index 1
+        f.write("static const uint64_t carp_keys[CARP_OPTION_COUNT + 1] = {\n\t0,\n")
+        carp_write_chunked(f, ("\t0x{:016x},\n".format(carp_key_prefix(v["name"])) for v in ct_eytzinger[1:]))
+        f.write("};\n\n")
+
+        f.write("static const {} carp_lens[CARP_OPTION_COUNT + 1] = {{\n\t0,\n".format(c_uint_type(max_option_name_len)))
+        carp_write_chunked(f, ("\t{},\n".format(len(v["name"].encode())) for v in ct_eytzinger[1:]))
+        f.write("};\n\n")
+
+        f.write("static const {} carp_suffixes[CARP_OPTION_COUNT + 1] = {{\n\t0,\n".format(c_uint_type(pool_len)))
+        carp_write_chunked(f, ("\t{},\n".format(v) for v in pool_offsets))
+        f.write("};\n\n")
+
+        f.write("static const {} carp_ids[CARP_OPTION_COUNT + 1] = {{\n\t0,\n".format(c_uint_type(len(specs))))
+        carp_write_chunked(f, ("\t{},\n".format(v["id"]) for v in ct_eytzinger[1:]))
+        f.write("};\n\n")
+
+        f.write("static uint64_t carp_key_prefix(const char* name, int len) {\n")
+        f.write("\tuint64_t prefix = 0;\n")
+        f.write("\tfor (int i = 0; i < 8; i++) {\n")
+        f.write("\t\tprefix = (prefix << 8) | (i < len ? (unsigned char)name[i] : 0);\n")
+        f.write("\t}\n")
+        f.write("\treturn prefix;\n")
+        f.write("}\n\n")
 
-        f.write("\tvoid* result = bsearch(&key, opts, sizeof(opts) / sizeof(opts[0]), sizeof(opts[0]), compare_options);\n")
-        f.write("\tif (result) return &((struct CarpOption*)result)->spec;\n")
-        f.write("\telse return NULL;\n")
+        # Order the names past their 8-byte prefix; only reached when the prefixes are equal
+        f.write("static int carp_compare_suffix(unsigned k, const char* name, int len) {\n")
+        f.write("\tint klen = carp_lens[k] > 8 ? carp_lens[k] - 8 : 0;\n")
+        f.write("\tint nlen = len > 8 ? len - 8 : 0;\n")
+        f.write("\tint n = klen < nlen ? klen : nlen;\n")
+        f.write("\tint cmp = n ? memcmp(carp_pool + carp_suffixes[k], name + 8, n) : 0;\n")
+        f.write("\treturn cmp ? cmp : klen - nlen;\n")
+        f.write("}\n\n")
+
+        has_hot = carp_write_hot(f, carp_table)
+
+        f.write("const struct CarpOptionSpec* carp_search(const char* name, int len) {\n")
+        if has_hot:
+            f.write("\tconst struct CarpOptionSpec* hot = carp_hot(name, len);\n")
+            f.write("\tif (hot) return hot;\n\n")
+        f.write("\tif (len > {}) return NULL;\n\n".format(max_option_name_len))
+        f.write("\tuint64_t prefix = carp_key_prefix(name, len);\n")
+        f.write("\tunsigned k = 1;\n\n")
+
+        f.write("\twhile (k <= CARP_OPTION_COUNT) {\n")
+        f.write("#if defined(__GNUC__)\n")
+        f.write("\t\t__builtin_prefetch(carp_keys + 8 * k);\n")
+        f.write("#endif\n")
+        f.write("\t\tint less = carp_keys[k] < prefix ||\n")
+        f.write("\t\t\t(carp_keys[k] == prefix && carp_compare_suffix(k, name, len) < 0);\n")
+        f.write("\t\tk = 2 * k + less;\n")
+        f.write("\t}\n\n")
+
+        # Strip the trailing right turns (and the final left turn) to land on the lower bound
+        f.write("#if defined(__GNUC__)\n")
+        f.write("\tk >>= __builtin_ffs(~k);\n")
+        f.write("#else\n")
+        f.write("\twhile (k & 1) k >>= 1;\n")
+        f.write("\tk >>= 1;\n")
+        f.write("#endif\n\n")
+
+        f.write("\tif (k && carp_keys[k] == prefix && carp_lens[k] == len && !carp_compare_suffix(k, name, len)) {\n")
+        f.write("\t\treturn &carp_specs[carp_ids[k]];\n")
+        f.write("\t}\n")
+        f.write("\treturn NULL;\n")
         f.write("}\n")
 
+    # Only a complete file may carry the hash header, see carp_output_is_current()
+    os.replace(search_tmp_abs_path, search_output_abs_path)
+
 ###
 #  Start of script
 ###
 
 def main():
+    # Optional arguments go first; the remaining ones are positional
+    CARP_PROFILE_FILE = None
+    if sys.argv[1:2] == ["--profile"]:
+        if len(sys.argv) < 3:
+            exit_with_error("--profile requires a file")
+        CARP_PROFILE_FILE = sys.argv[2]
+        del sys.argv[1:3]
+        if not os.path.exists(CARP_PROFILE_FILE):
+            exit_with_error("cannot find profile {}".format(CARP_PROFILE_FILE))
+
     # Validate command line arguments
     CARP_IMPLEMENTATION = sys.argv[1].lower() if sys.argv[1:] else ""
-    if len(sys.argv) != 4 or not {CARP_IMPLEMENTATION}.issubset({"hash", "search"}):
-        exit_with_error("usage: ./carp.py <hash | search> <output_dir> <carp.json>")
+    if len(sys.argv) == 3:
+        exit_with_error("no json files provided; set CARP_JSON_FILE or call carp_add_options()")
+    if len(sys.argv) < 4 or not {CARP_IMPLEMENTATION}.issubset({"hash", "search"}):
+        exit_with_error("usage: ./carp.py [--profile <profile>] <hash | search> <output_dir> <carp.json> [<carp.json> ...]")
 
     if (CARP_IMPLEMENTATION == "hash") and (not which("gperf")):
         exit_with_error("cannot find 'gperf' executable")
@@ -232,28 +844,62 @@ def main():
     if not os.path.exists(sys.argv[2]):
         exit_with_error("cannot find output directory {}".format(sys.argv[2]))
 
-    if not os.path.exists(sys.argv[3]):
-        exit_with_error("cannot find input json file {}".format(sys.argv[3]))
+    for json_file in sys.argv[3:]:
+        if not os.path.exists(json_file):
+            exit_with_error("cannot find input json file {}".format(json_file))
 
     CARP_OUTPUT_DIR = sys.argv[2]
-    CARP_JSON_FILE = sys.argv[3]
+    CARP_JSON_FILES = sys.argv[3:]
+
+    # Merge the options of every json file into a single table.
+    # Option ids keep counting across files, so every option gets its own id.
+    option_id = 0
+    program = None
+    for json_file in CARP_JSON_FILES:
+        carp_json = carp_read_json(json_file)
+        if program is None:
+            program = carp_json.get("program")
+
+        for option in carp_json["options"]:
+            opt = option.copy()
+            clean = carp_json_option_validate(opt)
+            for v in clean:
+                v["id"] = option_id
+                if "short" in v.keys():
+                    name = v.pop("short")
+                else:
+                    name = v.pop("long")
+                carp_table_add_option(name, v, json_file)
+            option_id += 1
+
+    if not carp_table:
+        exit_with_error("no options defined in {}".format(" ".join(CARP_JSON_FILES)))
+
+    carp_table_resolve_async(carp_table)
+    carp_table_resolve_constraints(carp_table)
+    if CARP_PROFILE_FILE:
+        carp_table_apply_profile(carp_table, carp_read_profile(CARP_PROFILE_FILE))
+
+    if program is None:
+        program = splitext(basename(CARP_JSON_FILES[0]))[0]
+    if not isinstance(program, str) or not program:
+        exit_with_error("json field 'program' must be a non-empty string")
+    carp_generate_completion_scripts(program, CARP_OUTPUT_DIR)
 
-    carp_json = carp_read_json(CARP_JSON_FILE)
+    if CARP_IMPLEMENTATION == "hash":
+        output_abs_path = realpath(join(CARP_OUTPUT_DIR, "carp_hash.c"))
+    else:
+        output_abs_path = realpath(join(CARP_OUTPUT_DIR, "carp_search.c"))
 
-    for option in carp_json["options"]:
-        opt = option.copy()
-        clean = carp_json_option_validate(opt)
-        for v in clean:
-            if "short" in v.keys():
-                name = v.pop("short")
-            else:
-                name = v.pop("long")
-            carp_table_add_option(name, v)
+    # Leave the output untouched (including its timestamp) if the table hasn't changed
+    spec_hash = carp_table_hash(carp_table, CARP_IMPLEMENTATION)
+    if carp_output_is_current(output_abs_path, spec_hash):
+        return
 
     if CARP_IMPLEMENTATION == "hash":
-        carp_gperf_generate_hash(carp_table, CARP_OUTPUT_DIR)
+        carp_gperf_generate_hash(carp_table, CARP_OUTPUT_DIR, spec_hash)
     else:
-        carp_generate_search(carp_table, CARP_OUTPUT_DIR)
+        carp_generate_search(carp_table, CARP_OUTPUT_DIR, spec_hash)
 
 if __name__ == '__main__':
     main()
@@ -1,5 +1,9 @@
+import io
 import unittest
-from carp import carp_json_option_validate, carp_table_add_option, carp_table
+from carp import carp_json_option_validate, carp_table_add_option, carp_table, carp_table_hash, \
+    carp_eytzinger_order, carp_key_prefix, carp_table_resolve_async, \
+    carp_table_resolve_constraints, carp_constraint_mask, \
+    carp_write_completions, carp_write_specs, carp_table_apply_profile, carp_hot_options, carp_write_hot
 
 class TestCarpTableAddOption(unittest.TestCase):
     def test_add_option(self):
@@ -14,6 +18,118 @@ class TestCarpTableAddOption(unittest.TestCase):
         with self.assertRaises(SystemExit):
             carp_table_add_option("foo", {"requiresArguments": "true", "callback": "none"})
 
+    def test_naming_collision_between_files(self):
+        carp_table_add_option("baz", {"requiresArguments": "true", "callback": "none"}, "a.json")
+        with self.assertRaises(SystemExit):
+            carp_table_add_option("baz", {"requiresArguments": "true", "callback": "none"}, "b.json")
+
+class TestCarpTableHash(unittest.TestCase):
+    def test_list_order_independent(self):
+        a = [{"name": "foo", "id": 0, "arguments": 0, "callback": "none"},
+             {"name": "bar", "id": 1, "arguments": 1, "callback": "none"}]
+        self.assertEqual(carp_table_hash(a, "search"), carp_table_hash(list(reversed(a)), "search"))
+
+    def test_id_change(self):
+        # Reordering options in the json file reassigns their ids
+        a = [{"name": "foo", "id": 0, "arguments": 0, "callback": "none"},
+             {"name": "bar", "id": 1, "arguments": 1, "callback": "none"}]
+        b = [{"name": "foo", "id": 1, "arguments": 0, "callback": "none"},
+             {"name": "bar", "id": 0, "arguments": 1, "callback": "none"}]
+        self.assertNotEqual(carp_table_hash(a, "search"), carp_table_hash(b, "search"))
+
+    def test_spec_change(self):
+        a = [{"name": "foo", "arguments": 0, "callback": "none"}]
+        b = [{"name": "foo", "arguments": 1, "callback": "none"}]
+        self.assertNotEqual(carp_table_hash(a, "search"), carp_table_hash(b, "search"))
+        self.assertNotEqual(carp_table_hash(a, "search"), carp_table_hash(a, "hash"))
+
+class TestCarpSearchLayout(unittest.TestCase):
+    def test_eytzinger_order(self):
+        self.assertEqual(carp_eytzinger_order([1, 2, 3, 4, 5, 6, 7]), [None, 4, 2, 6, 1, 3, 5, 7])
+        self.assertEqual(carp_eytzinger_order([1, 2, 3, 4, 5]), [None, 4, 2, 5, 1, 3])
+
+    def test_key_prefix_order(self):
+        names = ["a", "ab", "abcdefgh", "abcdefghij", "b", "verbose"]
+        self.assertEqual(sorted(names, key=carp_key_prefix), names)
+        self.assertEqual(carp_key_prefix("abcdefgh"), carp_key_prefix("abcdefghij"))
+
+class TestCarpTableResolveAsync(unittest.TestCase):
+    def option(self, name, option_id, is_async=False, after=[]):
+        return {"name": name, "id": option_id, "arguments": 0, "callback": "none", "async": is_async, "after": after, "repeat": "each",
+                "required": False, "conflicts": [], "requires": []}
+
+    def test_levels(self):
+        table = [self.option("a", 0, True),
+                 self.option("b", 1),
+                 self.option("c", 2, True, ["a", "b"]),
+                 self.option("d", 3, True, ["c"]),
+                 self.option("e", 4, True, ["b"])]
+        carp_table_resolve_async(table)
+        self.assertEqual([v["level"] for v in table], [0, 0, 1, 2, 1])
+
+    def test_cycle(self):
+        with self.assertRaises(SystemExit):
+            carp_table_resolve_async([self.option("a", 0, True, ["b"]), self.option("b", 1, True, ["a"])])
+
+    def test_unknown_dependency(self):
+        with self.assertRaises(SystemExit):
+            carp_table_resolve_async([self.option("a", 0, True, ["z"])])
+
+    def test_after_requires_async(self):
+        with self.assertRaises(SystemExit):
+            carp_table_resolve_async([self.option("a", 0), self.option("b", 1, False, ["a"])])
+
+class TestCarpConstraints(unittest.TestCase):
+    def option(self, name, option_id, conflicts=[], requires=[]):
+        return {"name": name, "id": option_id, "conflicts": conflicts, "requires": requires}
+
+    def test_resolve(self):
+        table = [self.option("f", 0, ["v"]),
+                 self.option("file", 0, ["v"]),
+                 self.option("v", 1, [], ["file", "f"])]
+        carp_table_resolve_constraints(table)
+        self.assertEqual(table[1]["conflicts"], [1])
+        self.assertEqual(table[2]["requires"], [0])
+
+    def test_unknown_option(self):
+        with self.assertRaises(SystemExit):
+            carp_table_resolve_constraints([self.option("f", 0, ["z"])])
+
+    def test_self_reference(self):
+        with self.assertRaises(SystemExit):
+            carp_table_resolve_constraints([self.option("f", 0, [], ["f"])])
+
+    def test_mask(self):
+        self.assertEqual(carp_constraint_mask([0, 3]), (0, [0b1001]))
+        self.assertEqual(carp_constraint_mask([70, 200]), (1, [1 << 6, 0, 1 << 8]))
+
+class TestCarpSpecs(unittest.TestCase):
+    def test_too_many_aggregates(self):
+        specs = [{"id": i, "repeat": "aggregate", "callback": "none"} for i in range(0x10000)]
+        with self.assertRaises(SystemExit):
+            carp_write_specs(io.StringIO(), specs, ["none"], "0" * 64)
+
+class TestCarpCompletions(unittest.TestCase):
+    def test_sorted_flags(self):
+        f = io.StringIO()
+        carp_write_completions(f, [{"name": "verbose"}, {"name": "v"}, {"name": "file"}, {"name": "f"}])
+        flags = [line.strip()[1:-3] for line in f.getvalue().splitlines() if line.endswith('\\0"')]
+        self.assertEqual(flags, ["--file", "--verbose", "-f", "-v"])
+
+class TestCarpHotOptions(unittest.TestCase):
+    def test_profile_weights(self):
+        table = [{"name": "v", "id": 0, "weight": 0},
+                 {"name": "verbose", "id": 0, "weight": 0},
+                 {"name": "f", "id": 1, "weight": 5},
+                 {"name": "x", "id": 2, "weight": 0}]
+        carp_table_apply_profile(table, {"v": 10, "verbose": 2})
+        self.assertEqual([v["name"] for v in carp_hot_options(table)], ["v", "f", "verbose"])
+
+    def test_no_weights(self):
+        f = io.StringIO()
+        self.assertFalse(carp_write_hot(f, [{"name": "v", "id": 0, "weight": 0}]))
+        self.assertEqual(f.getvalue(), "")
+
 class TestCarpJsonOptionValidate(unittest.TestCase):
     def test_missing_option_name(self):
         with self.assertRaises(SystemExit):
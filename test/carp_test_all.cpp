@@ -1,7 +1,10 @@
+#include <cstdio>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <catch2/catch.hpp>
+#include <unistd.h>
 
 enum CarpTokenType {
     TOKEN_SHORT_OPTION = 0,
@@ -12,18 +15,27 @@ enum CarpTokenType {
 
 struct CarpPrivate;
 
+extern "C" {
+    #include "carp_backend.h"
+    #include "carp_async.h"
+    #include "carp_record.h"
+}
+
 // Bypass the carp backend so callback invocations are directed to this translation unit
-typedef void (*CARP_CALLBACK)(void*, const char**, int);
-struct CarpOptionSpec {
-    int arguments;
-    CARP_CALLBACK callback;
-};
 struct CarpTable {
     std::string option;
     CarpOptionSpec spec;
 };
 std::vector<CarpTable> g_table;
 int g_callback_retval = 0;
+std::mutex g_callback_log_lock;
+std::vector<std::string> g_callback_log;
+std::vector<std::vector<std::string>> g_callback_calls;
+int g_aggregate_count = 0;
+uint64_t g_table_id = 1;
+int g_constraint_count = 0;
+const struct CarpConstraint* g_violation = NULL;
+unsigned int g_violation_other = 0;
 
 extern "C" {
     #include "carp_argument_vector.h"
@@ -32,12 +44,32 @@ extern "C" {
     extern int carp_option_argument_handler(struct CarpPrivate* c, int required_arguments, const char* immediate);
     extern void carp_parse_short_option(struct CarpPrivate* c);
     extern void carp_parse_long_option(struct CarpPrivate* c);
+    extern void carp_check_constraints(struct CarpPrivate* c);
+    extern void carp_error_msg_missing_required_option(struct CarpPrivate* c, char* msg_buf, int buf_size);
+    extern void carp_error_msg_conflicting_options(struct CarpPrivate* c, char* msg_buf, int buf_size);
+    extern void carp_error_msg_missing_dependency(struct CarpPrivate* c, char* msg_buf, int buf_size);
+    extern void carp_error_msg_out_of_memory(struct CarpPrivate* c, char* msg_buf, int buf_size);
     void carp_callback_override(void* param, const char** buf, int len)
     {
         (void)param; (void)buf;
         g_callback_retval = len;
     }
-    struct CarpOptionSpec* carp_backend_search(const char* name, int len)
+    void carp_callback_log(void* param, const char** buf, int len)
+    {
+        (void)param;
+        std::lock_guard<std::mutex> guard{ g_callback_log_lock };
+        g_callback_log.push_back(len > 0 ? buf[0] : "");
+    }
+    void carp_callback_record(void* param, const char** buf, int len)
+    {
+        (void)param;
+        std::vector<std::string> call{ std::to_string(len) };
+        for (int i = 0; buf != NULL && i < len; i++) {
+            call.push_back(buf[i]);
+        }
+        g_callback_calls.push_back(call);
+    }
+    const struct CarpOptionSpec* carp_backend_search(const char* name, int len)
     {
         std::string opt{ name, static_cast<std::string::size_type>(len) };
 
@@ -48,6 +80,54 @@ extern "C" {
         }
         return NULL;
     }
+    CARP_CALLBACK carp_backend_callback(const struct CarpOptionSpec* spec)
+    {
+        switch (spec->callback) {
+            case 1: return carp_callback_log;
+            case 2: return carp_callback_record;
+            default: return carp_callback_override;
+        }
+    }
+    int carp_backend_aggregate_count(void)
+    {
+        return g_aggregate_count;
+    }
+    int carp_backend_option_count(void)
+    {
+        return static_cast<int>(g_table.size());
+    }
+    int carp_backend_constraint_count(void)
+    {
+        return g_constraint_count;
+    }
+    const char* carp_backend_option_name(unsigned int id)
+    {
+        return g_table[id].option.c_str();
+    }
+    const struct CarpOptionSpec* carp_backend_spec(unsigned int id)
+    {
+        return &g_table[id].spec;
+    }
+    uint64_t carp_backend_table_id(void)
+    {
+        return g_table_id;
+    }
+    int carp_backend_complete(const char* prefix, int len, int* first)
+    {
+        (void)prefix; (void)len;
+        *first = 0;
+        return 0;
+    }
+    const char* carp_backend_completion(int i)
+    {
+        return g_table[i].option.c_str();
+    }
+    const struct CarpConstraint* carp_backend_check_constraints(const uint64_t* seen, unsigned int* other)
+    {
+        (void)seen;
+        *other = g_violation_other;
+        return g_violation;
+    }
 }
 
 struct CarpPrivateState {
@@ -76,9 +156,15 @@ struct CarpPrivate {
         , callback_args{ callback_args }
         , command_args{ command_args }
         , callback_param{ NULL }
+        , async{ &async_state }
+        , aggregates{ NULL }
+        , seen{ NULL }
+        , constraint_other{ NULL }
+        , record{ NULL }
     {
         carp_vector_init(callback_args, 25);
         carp_vector_init(command_args, 25);
+        carp_async_init(async);
     }
 
     ~CarpPrivate()
@@ -95,6 +181,13 @@ struct CarpPrivate {
     void* callback_param;
 
     CarpPrivateState state;
+
+    CarpAsync* async;
+    struct CarpAggregate* aggregates;
+    uint64_t* seen;
+    const char* constraint_other;
+    struct CarpRecord* record;
+    CarpAsync async_state;
 };
 
 // See: https://github.com/catchorg/Catch2/issues/1813
@@ -218,7 +311,7 @@ TEST_CASE("test carp_parse_short_option()", "[.]") {
         // -v
         c.state.head = 1;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "v", CarpOptionSpec{ 0, carp_callback_override }});
+        g_table.push_back(CarpTable{ "v", CarpOptionSpec{ 0, 0 }});
         carp_parse_short_option(&c);
 
         REQUIRE(g_callback_retval == 0);
@@ -229,7 +322,7 @@ TEST_CASE("test carp_parse_short_option()", "[.]") {
         // -afile1 file2
         c.state.head = 2;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "a", CarpOptionSpec{ 3, carp_callback_override }});
+        g_table.push_back(CarpTable{ "a", CarpOptionSpec{ 3, 0 }});
         carp_parse_short_option(&c);
 
         REQUIRE(g_callback_retval == 3);
@@ -243,7 +336,7 @@ TEST_CASE("test carp_parse_short_option()", "[.]") {
         // -b out1 out2
         c.state.head = 5;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "b", CarpOptionSpec{ -1, carp_callback_override }});
+        g_table.push_back(CarpTable{ "b", CarpOptionSpec{ -1, 0 }});
         carp_parse_short_option(&c);
 
         REQUIRE(g_callback_retval == 2);
@@ -257,8 +350,8 @@ TEST_CASE("test carp_parse_short_option()", "[.]") {
         // -xfv argument
         c.state.head = 9;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "x", CarpOptionSpec{ 0, carp_callback_override }});
-        g_table.push_back(CarpTable{ "f", CarpOptionSpec{ 2, carp_callback_override }});
+        g_table.push_back(CarpTable{ "x", CarpOptionSpec{ 0, 0 }});
+        g_table.push_back(CarpTable{ "f", CarpOptionSpec{ 2, 0 }});
         carp_parse_short_option(&c);
 
         REQUIRE(g_callback_retval == 2);
@@ -295,7 +388,7 @@ TEST_CASE("test carp_parse_long_option()", "[.]") {
         // --long=argument
         c.state.head = 1;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 1, carp_callback_override }});
+        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 1, 0 }});
         carp_parse_long_option(&c);
 
         REQUIRE(g_callback_retval == 1);
@@ -308,7 +401,7 @@ TEST_CASE("test carp_parse_long_option()", "[.]") {
         // --long
         c.state.head = 2;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 0, carp_callback_override }});
+        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 0, 0 }});
         carp_parse_long_option(&c);
 
         REQUIRE(g_callback_retval == 0);
@@ -320,7 +413,7 @@ TEST_CASE("test carp_parse_long_option()", "[.]") {
         // --long arg1 arg2 arg3
         c.state.head = 2;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 3, carp_callback_override }});
+        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 3, 0 }});
         carp_parse_long_option(&c);
 
         REQUIRE(g_callback_retval == 3);
@@ -335,7 +428,7 @@ TEST_CASE("test carp_parse_long_option()", "[.]") {
         // --long arg1 arg2 arg3
         c.state.head = 2;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ -1, carp_callback_override }});
+        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ -1, 0 }});
         carp_parse_long_option(&c);
 
         REQUIRE(g_callback_retval == 3);
@@ -365,7 +458,7 @@ TEST_CASE("test carp_parse_long_option()", "[.]") {
         // --long=argument
         c.state.head = 1;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ -1, carp_callback_override }});
+        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ -1, 0 }});
 
         REQUIRE_THROWS_WITH(carp_parse_long_option(&c), "exit");
 
@@ -375,7 +468,7 @@ TEST_CASE("test carp_parse_long_option()", "[.]") {
         // --long=argument
         c.state.head = 1;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 3, carp_callback_override }});
+        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 3, 0 }});
 
         REQUIRE_THROWS_WITH(carp_parse_long_option(&c), "exit");
 
@@ -385,7 +478,7 @@ TEST_CASE("test carp_parse_long_option()", "[.]") {
         // --long=
         c.state.head = 6;
         c.state.token = c.argv[c.state.head];
-        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 1, carp_callback_override }});
+        g_table.push_back(CarpTable{ "long", CarpOptionSpec{ 1, 0 }});
 
         REQUIRE_THROWS_WITH(carp_parse_long_option(&c), "exit");
 
@@ -412,13 +505,13 @@ TEST_CASE("test carp_parse()") {
     };
     int argc = sizeof(argv) / sizeof(argv[0]);
 
-    g_table.push_back(CarpTable{ "a", CarpOptionSpec{ 0, carp_callback_override}});
-    g_table.push_back(CarpTable{ "b", CarpOptionSpec{ 0, carp_callback_override}});
-    g_table.push_back(CarpTable{ "c", CarpOptionSpec{ 0, carp_callback_override}});
-    g_table.push_back(CarpTable{ "foo", CarpOptionSpec{ 1, carp_callback_override}});
-    g_table.push_back(CarpTable{ "x", CarpOptionSpec{ 3, carp_callback_override}});
+    g_table.push_back(CarpTable{ "a", CarpOptionSpec{ 0, 0 }});
+    g_table.push_back(CarpTable{ "b", CarpOptionSpec{ 0, 0 }});
+    g_table.push_back(CarpTable{ "c", CarpOptionSpec{ 0, 0 }});
+    g_table.push_back(CarpTable{ "foo", CarpOptionSpec{ 1, 0 }});
+    g_table.push_back(CarpTable{ "x", CarpOptionSpec{ 3, 0 }});
 
-    carp_parse(&carp, argc, (char**)argv);
+    carp_parse(&carp, argc, (char**)argv, NULL);
 
     REQUIRE(carp.argc == 6);
     REQUIRE(std::string(carp.argv[0]) == "cmd_arg1");
@@ -434,3 +527,222 @@ TEST_CASE("test carp_parse()") {
     REQUIRE(carp.argv == NULL);
     REQUIRE(carp.argc == 0);
 }
+
+TEST_CASE("test carp_parse() async callbacks") {
+    const char* argv[] = {
+        "a.out",
+        "-b",
+        "second",
+        "-a",
+        "first1",
+        "-a",
+        "first2",
+        "cmd_arg1"
+    };
+    int argc = sizeof(argv) / sizeof(argv[0]);
+
+    // 'b' declares "after": ["a"], so it must run after every occurrence of 'a'
+    g_table.push_back(CarpTable{ "a", CarpOptionSpec{ 1, CARP_SPEC_ASYNC, 0, 1 }});
+    g_table.push_back(CarpTable{ "b", CarpOptionSpec{ 1, CARP_SPEC_ASYNC, 1, 1 }});
+
+    struct Carp carp;
+    carp_parse(&carp, argc, (char**)argv, NULL);
+
+    // Every async callback has returned by the time carp_parse() does
+    REQUIRE(g_callback_log.size() == 3);
+    REQUIRE(g_callback_log[2] == "second");
+    REQUIRE(carp.argc == 1);
+    REQUIRE(std::string(carp.argv[0]) == "cmd_arg1");
+
+    carp_cleanup(&carp);
+    g_table.clear();
+    g_callback_log.clear();
+}
+
+TEST_CASE("test carp_parse() aggregated options") {
+    const char* argv[] = {
+        "a.out",
+        "-I",
+        "dir1",
+        "-v",
+        "-Idir2",
+        "cmd_arg1",
+        "-vv",
+        "-I",
+        "dir3"
+    };
+    int argc = sizeof(argv) / sizeof(argv[0]);
+
+    g_aggregate_count = 2;
+    g_table.push_back(CarpTable{ "I", CarpOptionSpec{ 1, CARP_SPEC_AGGREGATE, 0, 2, 0 }});
+    g_table.push_back(CarpTable{ "v", CarpOptionSpec{ 0, CARP_SPEC_AGGREGATE, 0, 2, 1 }});
+
+    struct Carp carp;
+    carp_parse(&carp, argc, (char**)argv, NULL);
+
+    // One call per option, in slot order
+    REQUIRE(g_callback_calls.size() == 2);
+    REQUIRE(g_callback_calls[0] == std::vector<std::string>{ "3", "dir1", "dir2", "dir3" });
+    REQUIRE(g_callback_calls[1] == std::vector<std::string>{ "3" });
+    REQUIRE(carp.argc == 1);
+
+    carp_cleanup(&carp);
+    g_table.clear();
+    g_callback_calls.clear();
+    g_aggregate_count = 0;
+}
+
+TEST_CASE("test carp_parse_save() and carp_load_parsed()") {
+    const char* argv[] = {
+        "a.out",
+        "-v",
+        "-f",
+        "in.txt",
+        "out.txt",
+        "cmd_arg1",
+        "-Idir1",
+        "-I",
+        "dir2",
+        "--",
+        "cmd_arg2"
+    };
+    int argc = sizeof(argv) / sizeof(argv[0]);
+
+    // Option ids are the table indices
+    g_aggregate_count = 1;
+    g_table.push_back(CarpTable{ "v", CarpOptionSpec{ 0, 0, 0, 2, 0, 0 }});
+    g_table.push_back(CarpTable{ "f", CarpOptionSpec{ 2, 0, 0, 2, 0, 1 }});
+    g_table.push_back(CarpTable{ "I", CarpOptionSpec{ 1, CARP_SPEC_AGGREGATE, 0, 2, 0, 2 }});
+
+    FILE* file = tmpfile();
+    REQUIRE(file != NULL);
+
+    struct Carp carp;
+    REQUIRE(carp_parse_save(&carp, argc, (char**)argv, NULL, fileno(file)) == 0);
+    std::vector<std::vector<std::string>> parsed = g_callback_calls;
+    REQUIRE(parsed.size() == 3);
+    carp_cleanup(&carp);
+    g_callback_calls.clear();
+
+    // The same callbacks are invoked with the same arguments, and the same non-option arguments are returned
+    REQUIRE(carp_load_parsed(&carp, fileno(file), NULL) == 0);
+    REQUIRE(g_callback_calls == parsed);
+    REQUIRE(carp.argc == 2);
+    REQUIRE(std::string(carp.argv[0]) == "cmd_arg1");
+    REQUIRE(std::string(carp.argv[1]) == "cmd_arg2");
+    carp_cleanup(&carp);
+    g_callback_calls.clear();
+
+    // A record from a different option table is rejected without invoking anything
+    g_table_id = 2;
+    REQUIRE(carp_load_parsed(&carp, fileno(file), NULL) != 0);
+    REQUIRE(g_callback_calls.empty());
+    g_table_id = 1;
+
+    // So is an entry whose argument count doesn't match its option, even when its arguments are in bounds
+    uint32_t argc_v = 1;
+    size_t argc_offset = sizeof(struct CarpRecordHeader) + offsetof(struct CarpRecordEntry, argc);
+    REQUIRE(pwrite(fileno(file), &argc_v, sizeof(argc_v), argc_offset) == sizeof(argc_v));
+    REQUIRE(carp_load_parsed(&carp, fileno(file), NULL) != 0);
+    REQUIRE(g_callback_calls.empty());
+
+    fclose(file);
+    g_table.clear();
+    g_aggregate_count = 0;
+}
+
+TEST_CASE("test carp_check_constraints()") {
+    const char* argv[] = { "a.out" };
+    int argc = sizeof(argv) / sizeof(argv[0]);
+    CarpArgumentVector callback_args, command_args;
+
+    g_table.push_back(CarpTable{ "--alpha", CarpOptionSpec{ 0, 0 }});
+    g_table.push_back(CarpTable{ "--beta", CarpOptionSpec{ 0, 0 }});
+
+    CarpPrivate c(argc, argv, &callback_args, &command_args);
+    char msg_buf[100];
+
+    SECTION("no violation") {
+        c.seen = static_cast<uint64_t*>(calloc(1, sizeof(uint64_t)));
+        carp_check_constraints(&c);
+        free(c.seen);
+    }
+
+    SECTION("missing required option") {
+        struct CarpConstraint required = { CARP_CONSTRAINT_REQUIRED, 0, 0, 1, 0 };
+        g_violation = &required;
+        g_violation_other = 1;
+
+        c.seen = static_cast<uint64_t*>(calloc(1, sizeof(uint64_t)));
+        REQUIRE_THROWS_WITH(carp_check_constraints(&c), "exit");
+        carp_error_msg_missing_required_option(&c, msg_buf, sizeof(msg_buf));
+        REQUIRE(std::string(msg_buf) == "Option '--beta': option is required");
+    }
+
+    SECTION("conflicting options") {
+        struct CarpConstraint conflicts = { CARP_CONSTRAINT_CONFLICTS, 0, 0, 1, 0 };
+        g_violation = &conflicts;
+        g_violation_other = 1;
+
+        c.seen = static_cast<uint64_t*>(calloc(1, sizeof(uint64_t)));
+        REQUIRE_THROWS_WITH(carp_check_constraints(&c), "exit");
+        carp_error_msg_conflicting_options(&c, msg_buf, sizeof(msg_buf));
+        REQUIRE(std::string(msg_buf) == "Option '--alpha': cannot be combined with option '--beta'");
+    }
+
+    SECTION("missing dependency") {
+        struct CarpConstraint requires = { CARP_CONSTRAINT_REQUIRES, 1, 0, 1, 0 };
+        g_violation = &requires;
+        g_violation_other = 0;
+
+        c.seen = static_cast<uint64_t*>(calloc(1, sizeof(uint64_t)));
+        REQUIRE_THROWS_WITH(carp_check_constraints(&c), "exit");
+        carp_error_msg_missing_dependency(&c, msg_buf, sizeof(msg_buf));
+        REQUIRE(std::string(msg_buf) == "Option '--beta': requires option '--alpha'");
+    }
+
+    g_violation = NULL;
+    g_violation_other = 0;
+    g_table.clear();
+}
+
+TEST_CASE("test carp_error_msg_out_of_memory()") {
+    // Allocating the constraint bitset fails before the first token is read
+    const char* argv[] = { "a.out" };
+    CarpArgumentVector callback_args, command_args;
+    CarpPrivate c(1, argv, &callback_args, &command_args);
+    char msg_buf[100];
+
+    REQUIRE(c.state.token == nullptr);
+    carp_error_msg_out_of_memory(&c, msg_buf, sizeof(msg_buf));
+    REQUIRE(std::string(msg_buf) == "out of memory");
+}
+
+TEST_CASE("test carp_parse() constraint violation") {
+    const char* argv[] = { "a.out", "-a" };
+    int argc = sizeof(argv) / sizeof(argv[0]);
+    struct CarpConstraint required = { CARP_CONSTRAINT_REQUIRED, 0, 0, 1, 0 };
+
+    g_table.push_back(CarpTable{ "a", CarpOptionSpec{ 0, 0, 0, 2, 0, 0 }});
+    g_table.push_back(CarpTable{ "b", CarpOptionSpec{ 0, 0, 0, 2, 0, 1 }});
+    g_constraint_count = 1;
+
+    struct Carp carp;
+    SECTION("satisfied") {
+        carp_parse(&carp, argc, (char**)argv, NULL);
+        REQUIRE(g_callback_calls.size() == 1);
+        carp_cleanup(&carp);
+    }
+
+    SECTION("violated") {
+        g_violation = &required;
+        g_violation_other = 1;
+        REQUIRE_THROWS_WITH(carp_parse(&carp, argc, (char**)argv, NULL), "exit");
+    }
+
+    g_violation = NULL;
+    g_violation_other = 0;
+    g_constraint_count = 0;
+    g_callback_calls.clear();
+    g_table.clear();
+}
@@ -0,0 +1,135 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include <catch2/catch.hpp>
+
+extern "C" {
+    #include "carp_backend.h"
+}
+
+// Hand-written stand-ins for the tables carp.py generates, so carp_backend.c can be tested
+//  without running the generator
+extern "C" {
+    const struct CarpOptionSpec* carp_search(const char* name, int len)
+    {
+        (void)name; (void)len;
+        return NULL;
+    }
+
+    extern const CARP_CALLBACK carp_callbacks[1] = { NULL };
+    extern const int carp_aggregate_count = 0;
+    extern const uint64_t carp_table_id = 1;
+
+    // 130 options, so the bitset spans three words
+    extern const int carp_option_count = 130;
+
+    const char* carp_option_name(unsigned int id)
+    {
+        (void)id;
+        return "";
+    }
+
+    const struct CarpOptionSpec* carp_option_spec(unsigned int id)
+    {
+        (void)id;
+        return NULL;
+    }
+
+    // Option 3 is required, option 5 conflicts with option 70, option 2 requires options 3 and 129
+    extern const uint64_t carp_constraint_masks[] = {
+        UINT64_C(1) << 3,
+        UINT64_C(1) << (70 - 64),
+        UINT64_C(1) << 3, 0, UINT64_C(1) << (129 - 128)
+    };
+    extern const struct CarpConstraint carp_constraints[] = {
+        { CARP_CONSTRAINT_REQUIRED, 0, 0, 1, 0 },
+        { CARP_CONSTRAINT_CONFLICTS, 5, 1, 1, 1 },
+        { CARP_CONSTRAINT_REQUIRES, 2, 0, 3, 2 }
+    };
+    extern const int carp_constraint_count = sizeof(carp_constraints) / sizeof(carp_constraints[0]);
+
+    // Sorted bytewise, as carp.py emits them
+    static const char* const completions[] = { "--file", "--filter", "--verbose", "-f", "-v" };
+    extern const int carp_completion_count = sizeof(completions) / sizeof(completions[0]);
+
+    const char* carp_completion(int i)
+    {
+        return completions[i];
+    }
+}
+
+static void set_seen(uint64_t* seen, unsigned int id)
+{
+    seen[id / 64] |= UINT64_C(1) << (id % 64);
+}
+
+TEST_CASE("test carp_backend_check_constraints()") {
+    uint64_t seen[3] = { 0, 0, 0 };
+    unsigned int other = 0;
+    const struct CarpConstraint* violated = NULL;
+
+    SECTION("missing required option") {
+        set_seen(seen, 70);
+        violated = carp_backend_check_constraints(seen, &other);
+        REQUIRE(violated == &carp_constraints[0]);
+        REQUIRE(other == 3);
+    }
+
+    SECTION("options whose relations don't hold are skipped when unseen") {
+        // 70 is listed by the conflict of 5, and 2 would require 129
+        set_seen(seen, 3);
+        set_seen(seen, 70);
+        REQUIRE(carp_backend_check_constraints(seen, &other) == NULL);
+    }
+
+    SECTION("conflicting options") {
+        set_seen(seen, 3);
+        set_seen(seen, 5);
+        set_seen(seen, 70);
+        violated = carp_backend_check_constraints(seen, &other);
+        REQUIRE(violated == &carp_constraints[1]);
+        REQUIRE(other == 70);
+    }
+
+    SECTION("missing dependency in a later word") {
+        set_seen(seen, 3);
+        set_seen(seen, 2);
+        violated = carp_backend_check_constraints(seen, &other);
+        REQUIRE(violated == &carp_constraints[2]);
+        REQUIRE(other == 129);
+
+        set_seen(seen, 129);
+        REQUIRE(carp_backend_check_constraints(seen, &other) == NULL);
+    }
+}
+
+static std::vector<std::string> complete(const char* prefix)
+{
+    int first = 0;
+    int count = carp_backend_complete(prefix, static_cast<int>(strlen(prefix)), &first);
+
+    std::vector<std::string> matches;
+    for (int i = first; i < first + count; i++) {
+        matches.push_back(carp_backend_completion(i));
+    }
+    return matches;
+}
+
+TEST_CASE("test carp_backend_complete()") {
+    // An empty prefix matches everything
+    REQUIRE(complete("") == std::vector<std::string>{ "--file", "--filter", "--verbose", "-f", "-v" });
+
+    REQUIRE(complete("--") == std::vector<std::string>{ "--file", "--filter", "--verbose" });
+    REQUIRE(complete("--fi") == std::vector<std::string>{ "--file", "--filter" });
+
+    // An exact match is included, along with the flags it is a prefix of
+    REQUIRE(complete("--file") == std::vector<std::string>{ "--file" });
+    REQUIRE(complete("--filte") == std::vector<std::string>{ "--filter" });
+    REQUIRE(complete("-v") == std::vector<std::string>{ "-v" });
+
+    // No matches, before, between and after the completions
+    REQUIRE(complete("+").empty());
+    REQUIRE(complete("--g").empty());
+    REQUIRE(complete("-z").empty());
+    REQUIRE(complete("--filters").empty());
+}
@@ -0,0 +1,104 @@
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <catch2/catch.hpp>
+
+extern "C" {
+    #include "carp.h"
+    #include "carp_libc.h"
+}
+
+// Every block is preceded by its size, padded to the maximum alignment
+static const size_t block_header = (sizeof(size_t) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+alignas(std::max_align_t) static unsigned char storage[256];
+
+TEST_CASE("test carp_malloc() and carp_realloc() with caller storage") {
+    carp_set_storage(storage, sizeof(storage));
+
+    SECTION("the last block grows in place") {
+        char* p = static_cast<char*>(carp_malloc(16));
+        REQUIRE(p != NULL);
+        memcpy(p, "0123456789abcdef", 16);
+
+        char* q = static_cast<char*>(carp_realloc(p, 64));
+        REQUIRE(q == p);
+        REQUIRE(memcmp(q, "0123456789abcdef", 16) == 0);
+    }
+
+    SECTION("a block which isn't the last one is copied") {
+        char* p = static_cast<char*>(carp_malloc(16));
+        REQUIRE(p != NULL);
+        memcpy(p, "0123456789abcdef", 16);
+        REQUIRE(carp_malloc(16) != NULL);
+
+        char* q = static_cast<char*>(carp_realloc(p, 32));
+        REQUIRE(q != NULL);
+        REQUIRE(q != p);
+        REQUIRE(memcmp(q, "0123456789abcdef", 16) == 0);
+    }
+
+    SECTION("the last block is released in place") {
+        void* p = carp_malloc(100);
+        REQUIRE(p != NULL);
+        carp_free(p);
+        REQUIRE(carp_malloc(100) == p);
+    }
+
+    SECTION("out of memory at the end of the storage") {
+        // A block (and its header) can use up the storage exactly, but not a byte more
+        REQUIRE(carp_malloc(sizeof(storage) - block_header + 1) == NULL);
+        void* p = carp_malloc(sizeof(storage) - block_header);
+        REQUIRE(p != NULL);
+        REQUIRE(carp_malloc(1) == NULL);
+        REQUIRE(carp_calloc(1, 1) == NULL);
+
+        // Growing the last block past the end fails and leaves it in place
+        carp_free(p);
+        p = carp_malloc(16);
+        REQUIRE(carp_realloc(p, sizeof(storage)) == NULL);
+        REQUIRE(carp_realloc(p, sizeof(storage) - block_header) == p);
+    }
+
+    SECTION("calloc clears memory reused after a release") {
+        unsigned char* p = static_cast<unsigned char*>(carp_malloc(32));
+        memset(p, 0xff, 32);
+        carp_free(p);
+
+        unsigned char* q = static_cast<unsigned char*>(carp_calloc(4, 8));
+        REQUIRE(q == p);
+        for (int i = 0; i < 32; i++) {
+            REQUIRE(q[i] == 0);
+        }
+    }
+}
+
+TEST_CASE("test carp_snprintf()") {
+    char buf[8];
+
+    SECTION("fits") {
+        REQUIRE(carp_snprintf(buf, sizeof(buf), "a%sb", "xy") == 4);
+        REQUIRE(std::string(buf) == "axyb");
+    }
+
+    SECTION("truncated") {
+        // The return value is the length of the full output, as with snprintf()
+        REQUIRE(carp_snprintf(buf, sizeof(buf), "ab%scd", "XYZW") == 8);
+        REQUIRE(std::string(buf) == "abXYZWc");
+        REQUIRE(carp_snprintf(buf, sizeof(buf), "%s%s", "01234", "56789") == 10);
+        REQUIRE(std::string(buf) == "0123456");
+    }
+
+    SECTION("no room at all") {
+        buf[0] = 'x';
+        REQUIRE(carp_snprintf(buf, 0, "%s", "abc") == 3);
+        REQUIRE(buf[0] == 'x');
+        REQUIRE(carp_snprintf(buf, 1, "%s", "abc") == 3);
+        REQUIRE(buf[0] == '\0');
+    }
+
+    SECTION("escapes and NULL strings") {
+        REQUIRE(carp_snprintf(buf, sizeof(buf), "%%%s", NULL) == 7);
+        REQUIRE(std::string(buf) == "%(null)");
+    }
+}